@@ -1,567 +1,166 @@
 #include <iostream>
 #include <fstream>
+#include <unistd.h>
+#include <cstdlib>
 #include <vector>
 #include <string>
-#include <map>
-#include <cassert>
 #include "Annotate.h"
+#include "Annotator.h"
 #include "String.h"
 #include "Fasta.h"
 #include "LineSplit.h"
 #include "Transcript.h"
+#include "TranscriptIndex.h"
+#include "Pipeline.h"
+#include "Output.h"
 
-static std::vector<std::string> Split(const std::string& s, const std::string& sep = "\t ", size_t count = 0)
+void OutputAnnotation(const LineSplit& fields, const AnnotationResult& result, size_t row, Output& out)
 {
-	std::vector<std::string> a;
-	size_t lastPos = s.find_first_not_of(sep);
-	while (lastPos != std::string::npos && (count == 0 || a.size() < count)) {
-		if (a.size() + 1 == count) {
-			a.push_back(s.substr(lastPos));
-		} else {
-			size_t pos = s.find_first_of(sep, lastPos);
-			if (pos == std::string::npos) {
-				a.push_back(s.substr(lastPos));
-			} else {
-				a.push_back(s.substr(lastPos, pos - lastPos));
-			}
-			lastPos = s.find_first_not_of(sep, pos);
-		}
+	for (size_t i = 0; i + 1 < fields.GetCount(); ++i) {
+		out << fields.GetField(i) << '\t';
 	}
-	return a;
-}
-
-bool LoadRefGene(const std::string& filename, std::map<std::string, std::vector<Transcript>>& data)
-{
-	std::ifstream file(filename, std::ios::in);
-	if (!file.is_open()) {
-		std::cerr << "Can not open file '" << filename << "'!" << std::endl;
-		return false;
+	const Transcript* trans = result.transcripts_[row];
+	if (trans) {
+		out << trans->strand_ << '\t' << trans->name_ << '\t' << trans->name2_;
+	} else {
+		out << ".\t.\t.";
 	}
-
-	//std::cerr << "Loading refGene '" << filename << "'" << std::endl;
-	time_t t0 = time(NULL);
-	size_t lineNo = 0;
-	int count = 0;
-	std::string line;
-	while (std::getline(file, line)) {
-		++lineNo;
-
-		time_t t = time(NULL);
-		if (t != t0) {
-			//std::cerr << "  " << count << " record(s) loaded\r" << std::flush;
-			t0 = t;
-		}
-
-		if (line.empty() || line[0] == '#') continue;
-
-		LineSplit sp;
-		sp.Split(line, '\t');
-
-		try {
-			std::string cdsStartStat = sp.GetField(13);
-			std::string cdsEndStat = sp.GetField(14);
-			if (cdsStartStat != "cmpl" || cdsEndStat != "cmpl") continue;
-
-			std::string name = sp.GetField(1);
-			std::string name2 = sp.GetField(12);
-			std::string chrom = sp.GetField(2);
-			std::string strand = sp.GetField(3);
-			int txStart = stoi(sp.GetField(4));
-			int txEnd = stoi(sp.GetField(5));
-			int cdsStart = stoi(sp.GetField(6));
-			int cdsEnd = stoi(sp.GetField(7));
-			int exonCount = stoi(sp.GetField(8));
-			std::string exonStarts = sp.GetField(9);
-			std::string exonEnds = sp.GetField(10);
-
-			Transcript item(name, name2, txStart, txEnd);
-			item.strand_ = strand;
-			item.cdsStart_ = cdsStart;
-			item.cdsEnd_ = cdsEnd;
-			if (!item.SetExons(exonCount, exonStarts, exonEnds)) {
-				std::cerr << "Invalid exon info at line " << lineNo << std::endl;
-			}
-			item.exonCount_ = exonCount;
-			item.exonStarts_ = exonStarts;
-			item.exonEnds_ = exonEnds;
-			data[chrom].push_back(item);
-
-			++count;
-		} catch (const std::exception& e) {
-			std::cerr << "Unexpected error in line " << lineNo << " of file '" << filename << "'! " << e.what() << std::endl;
-			file.close();
-			return false;
-		}
+	out << '\t' << (result.hgvsC_[row].empty() ? "." : result.hgvsC_[row]) << '\t';
+	Segment segment = result.segments_[row];
+	out << GetSegmentName(segment);
+	if (segment == SEGMENT_EXON) {
+		out << '(' << result.segmentNumbers_[row] << '/' << trans->exons_.size() << ')';
+	} else if (segment == SEGMENT_INTRON) {
+		out << '(' << result.segmentNumbers_[row] << '/' << trans->exons_.size() - 1 << ')';
 	}
-	//std::cerr << "Total " << count << " record(s) loaded" << std::endl;
-	file.close();
-	return true;
-}
-
-int GetTxPos(const std::vector<std::pair<int, int>>& exons, int pos)
-{
-	int count = 0;
-	for (size_t i = 0; i < exons.size(); ++i) {
-		int start = exons[i].first;
-		int end = exons[i].second;
-		if (pos < start) {
-			throw std::runtime_error("GetTxPos - bad pos (" + std::to_string(pos) + " < " + std::to_string(start) + ")");
-		}
-		if (pos < end) {
-			return count + (pos - start);
-		}
-		count += end - start;
+	out << '\t' << GetRegionName(result.regions_[row]);
+	const std::string* columns[] = { &result.codons1_[row], &result.codons2_[row], &result.hgvsP_[row], &result.hgvsP3_[row] };
+	for (size_t i = 0; i < 4; ++i) {
+		out << '\t' << (columns[i]->empty() ? "." : *columns[i]);
 	}
-	throw std::runtime_error("GetTxPos - bad pos (" + std::to_string(pos) + " >= " + std::to_string(exons.back().second) + ")");
-}
-
-const char* CODON_TABLE[4][4][4] = {
-	{
-		{ "F", "F", "L", "L" }, { "S", "S", "S", "S" },
-		{ "Y", "Y", "*", "*" }, { "C", "C", "*", "W" },
-	},
-	{
-		{ "L", "L", "L", "L" }, { "P", "P", "P", "P" },
-		{ "H", "H", "Q", "Q" }, { "R", "R", "R", "R" },
-	},
-	{
-		{ "I", "I", "I", "M" }, { "T", "T", "T", "T" },
-		{ "N", "N", "K", "K" }, { "S", "S", "R", "R" },
-	},
-	{
-		{ "V", "V", "V", "V" }, { "A", "A", "A", "A" },
-		{ "D", "D", "E", "E" }, { "G", "G", "G", "G" },
-	},
-};
-
-const char* CODON_TABLE_3[4][4][4] = {
-	{
-		{ "Phe", "Phe", "Leu", "Leu" }, { "Ser", "Ser", "Ser", "Ser" },
-		{ "Tyr", "Tyr", "*", "*" }, { "Cys", "Cys", "*", "Trp" }
-	},
-	{
-		{ "Leu", "Leu", "Leu", "Leu" }, { "Pro", "Pro", "Pro", "Pro" },
-		{ "His", "His", "Gln", "Gln" }, { "Arg", "Arg", "Arg", "Arg" },
-	},
-	{
-		{ "Ile", "Ile", "Ile", "Met" }, { "Thr", "Thr", "Thr", "Thr" },
-		{ "Asn", "Asn", "Lys", "Lys" }, { "Ser", "Ser", "Arg", "Arg" },
-	},
-	{
-		{ "Val", "Val", "Val", "Val" }, { "Ala", "Ala", "Ala", "Ala" },
-		{ "Asp", "Asp", "Glu", "Glu" }, { "Gly", "Gly", "Gly", "Gly" },
-	},
-};
-
-int GetBaseIndex(char c)
-{
-	if (c == 'T' || c == 't') return 0;
-	if (c == 'C' || c == 'c') return 1;
-	if (c == 'A' || c == 'a') return 2;
-	if (c == 'G' || c == 'g') return 3;
-	throw std::runtime_error("Invalid base '" + std::string(1, c) + "'");
+	out << '\t' << GetMutTypeName(result.mutTypes_[row])
+		<< '\t' << fields.GetField(fields.GetCount() - 1) << '\n';
 }
 
-std::string CompBase(const std::string& base)
+static void OutputHeader(const LineSplit& fields, size_t insertPos, Output& out)
 {
-	if (base == "A" || base == "a") {
-		return "T";
-	} else if (base == "C" || base == "c") {
-		return "G";
-	} else if (base == "G" || base == "g") {
-		return "C";
-	} else if (base == "T" || base == "t") {
-		return "A";
-	} else {
-		return base;
+	for (size_t i = 0; i < insertPos && i < fields.GetCount(); ++i) {
+		out << fields.GetField(i) << '\t';
 	}
-}
-
-std::string BaseToAA(const std::string& codon)
-{
-	return CODON_TABLE[GetBaseIndex(codon[0])][GetBaseIndex(codon[1])][GetBaseIndex(codon[2])];
-}
-
-std::string BaseToAA3(const std::string& codon)
-{
-	return CODON_TABLE_3[GetBaseIndex(codon[0])][GetBaseIndex(codon[1])][GetBaseIndex(codon[2])];
-}
-
-std::string GetMutType(const std::string& aa1, const std::string& aa2)
-{
-	if (aa1 == aa2) {
-		return "Synonymous";
-	} else if (aa1 == "*") {
-		return "Stop-codon-loss";
-	} else if (aa2 == "*") {
-		return "Stop-codon-gain";
-	} else {
-		return "Non-synonymous";
+	out << "strand\tname\tname2\tmutate\tsegment\ttype\tcodon1\tcodon2\tmutAA\tmutAA3\tmutType";
+	for (size_t i = insertPos; i < fields.GetCount(); ++i) {
+		out << '\t' << fields.GetField(i);
 	}
+	out << '\n';
 }
 
-bool Convert(const std::string& chrom, const Transcript& trans, int pos, const std::string& ref, const std::string alt,
-		const Fasta& fa, const std::vector<std::string>& fields)
+// lines of input annotated together by a worker
+struct Batch
 {
-	std::string res = ".";
-	std::string type = ".";
-	std::string type2 = ".";
-	std::string codon1 = ".";
-	std::string codon2 = ".";
-	std::string mutAA = ".";
-	std::string mutAA3 = ".";
-	std::string mutType = ".";
-
-	const auto& exons = trans.exons_;
-	int cdsStart = trans.cdsStart_ - trans.txStart_;
-	int cdsEnd = trans.cdsEnd_ - trans.txStart_;
-
-	if (cdsStart == cdsEnd) {
-		mutType = "Unknown";
-	} else if (trans.strand_ == "+") {
-		int cdsStartTxPos = GetTxPos(exons, cdsStart);
-		int cdsEndTxPos = GetTxPos(exons, cdsEnd - 1) + 1;
-
-		for (size_t i = 0; i < exons.size(); ++i) {
-			int start = exons[i].first;
-			int end = exons[i].second;
-			if (pos < cdsStart) { // 5'-UTR
-				if (pos < start) { // intron
-					if (i == 0 || (pos - exons[i - 1].second) > (start - pos)) {
-						res = "c.-" + std::to_string(cdsStartTxPos - GetTxPos(exons, start)) + "-" + std::to_string(start - pos);
-					} else {
-						res = "c.-" + std::to_string(cdsStartTxPos - GetTxPos(exons, exons[i - 1].second - 1)) + "+" + std::to_string(pos - (exons[i - 1].second - 1));
-					}
-					type = "Intron(" + std::to_string(i) + "/" + std::to_string(exons.size() - 1) + ")";
-					break;
-				} else if (pos < end) { // exon
-					res = "c.-" + std::to_string(cdsStartTxPos - GetTxPos(exons, pos));
-					type = "Exon(" + std::to_string(i + 1) + "/" + std::to_string(exons.size()) + ")";
-					type2 = "5'-UTR";
-					break;
-				}
-			} else if (pos >= cdsEnd) { // 3'-UTR
-				if (pos < start) { // intro
-					if (i == 0 || (pos - exons[i - 1].second) > (start - pos)) {
-						res = "c.*" + std::to_string(GetTxPos(exons, start) - cdsEndTxPos + 1) + "-" + std::to_string(start - pos);
-					} else {
-						res = "c.*" + std::to_string(GetTxPos(exons, exons[i - 1].second - 1) - cdsEndTxPos + 1) + "+" + std::to_string(pos - (exons[i - 1].second - 1));
-					}
-					type = "Intron(" + std::to_string(i) + "/" + std::to_string(exons.size() - 1) + ")";
-					break;
-				} else if (pos < end) { // exon
-					res = "c.*" + std::to_string(GetTxPos(exons, pos) - cdsEndTxPos + 1);
-					type = "Exon(" + std::to_string(i + 1) + "/" + std::to_string(exons.size()) + ")";
-					type2 = "3'-UTR";
-					break;
-				}
-			} else { // CDS
-				if (pos < start) { // intron
-					if (i == 0 || (pos - exons[i - 1].second) > (start - pos)) {
-						res = "c." + std::to_string(GetTxPos(exons, start) - cdsStartTxPos + 1) + "-" + std::to_string(start - pos);
-					} else {
-						res = "c." + std::to_string(GetTxPos(exons, exons[i - 1].second - 1) - cdsStartTxPos + 1) + "+" + std::to_string(pos - (exons[i - 1].second - 1));
-					}
-					type = "Intron(" + std::to_string(i) + "/" + std::to_string(exons.size() - 1) + ")";
-					break;
-				} else if (pos < end) { // exon
-					int mutPos = GetTxPos(exons, pos) - cdsStartTxPos;
-					res = "c." + std::to_string(mutPos + 1);
-					type = "Exon(" + std::to_string(i + 1) + "/" + std::to_string(exons.size()) + ")";
-					type2 = "CDS";
-
-					if (alt == "*") {
-						mutType = "Frameshift";
-					} else if (alt == ".") {
-						mutType = "Unknown";
-					} else if (alt.size() > 1) {
-						mutType = ((alt.size() - 2) % 3 == 0) ? "Inframe" : "Frameshift";
-					} else if (mutPos % 3 == 0) {
-						std::string base1 = fa.GetSeq(chrom, trans.txStart_ + pos);
-
-						int pos2 = pos + 1;
-						int index = i;
-						if (pos2 >= exons[i].second) {
-							++index;
-							assert(static_cast<size_t>(index) < exons.size());
-							pos2 = exons[index].first;
-						}
-						std::string base2 = fa.GetSeq(chrom, trans.txStart_ + pos2);
-
-						int pos3 = pos2 + 1;
-						if (pos3 >= exons[index].second) {
-							++index;
-							assert(static_cast<size_t>(index) < exons.size());
-							pos3 = exons[index].first;
-						}
-						std::string base3 = fa.GetSeq(chrom, trans.txStart_ + pos3);
-
-						codon1 = base1 + base2 + base3;
-						codon2 = alt + base2 + base3;
-						std::string aa1 = BaseToAA(codon1);
-						std::string aa2 = BaseToAA(codon2);
-						mutAA = "p." + aa1 + std::to_string(mutPos / 3 + 1) + aa2;
-						mutAA3 = "p." + BaseToAA3(codon1) + std::to_string(mutPos / 3 + 1) + BaseToAA3(codon2);
-						mutType = GetMutType(aa1, aa2);
-					} else if (mutPos % 3 == 1) {
-						std::string base2 = fa.GetSeq(chrom, trans.txStart_ + pos);
-
-						int pos2 = pos - 1;
-						if (pos2 < exons[i].first) {
-							assert(i > 0);
-							pos2 = exons[i - 1].second - 1;
-						}
-						std::string base1 = fa.GetSeq(chrom, trans.txStart_ + pos2);
-
-						int pos3 = pos + 1;
-						if (pos3 >= exons[i].second) {
-							assert(i + 1 < exons.size());
-							pos3 = exons[i + 1].first;
-						}
-						std::string base3 = fa.GetSeq(chrom, trans.txStart_ + pos3);
-
-						codon1 = base1 + base2 + base3;
-						codon2 = base1 + alt + base3;
-						std::string aa1 = BaseToAA(codon1);
-						std::string aa2 = BaseToAA(codon2);
-						mutAA = "p." + aa1 + std::to_string(mutPos / 3 + 1) + aa2;
-						mutAA3 = "p." + BaseToAA3(codon1) + std::to_string(mutPos / 3 + 1) + BaseToAA3(codon2);
-						mutType = GetMutType(aa1, aa2);
-					} else {
-						std::string base3 = fa.GetSeq(chrom, trans.txStart_ + pos);
-
-						int pos2 = pos - 1;
-						int index = i;
-						if (pos2 < exons[index].first) {
-							--index;
-							assert(index >= 0);
-							pos2 = exons[index].second - 1;
-						}
-						std::string base2 = fa.GetSeq(chrom, trans.txStart_ + pos2);
+	Batch(): lineNo_(0), failed_(false) { }
+
+	size_t lineNo_; // line number of the first line
+	std::vector<std::string> lines_;
+	Output output_;
+	std::vector<std::pair<int, int>> positions_; // chromosome id and position of each variant, for the order check
+	std::string unsorted_; // position the input is found not sorted at, e.g. chr1:100
+	bool failed_;
+	std::string error_;
+};
 
-						int pos3 = pos2 - 1;
-						if (pos3 < exons[index].first) {
-							--index;
-							assert(index >= 0);
-							pos3 = exons[index].second - 1;
-						}
-						std::string base1 = fa.GetSeq(chrom, trans.txStart_ + pos3);
+const size_t BATCH_SIZE = 1024;
 
-						codon1 = base1 + base2 + base3;
-						codon2 = base1 + base2 + alt;
-						std::string aa1 = BaseToAA(codon1);
-						std::string aa2 = BaseToAA(codon2);
-						mutAA = "p." + aa1 + std::to_string(mutPos / 3 + 1) + aa2;
-						mutAA3 = "p." + BaseToAA3(codon1) + std::to_string(mutPos / 3 + 1) + BaseToAA3(codon2);
-						mutType = GetMutType(aa1, aa2);
-					}
-					break;
-				}
+static bool ProcessBatch(Batch& batch, bool tsvFile, bool hasHeader, const Annotator& annotator)
+{
+	Output& out = batch.output_;
+	LineSplit fields;
+	std::string chrom;
+	VariantBatch variants;
+	std::vector<size_t> lines; // of each variant in batch.lines_
+	AnnotationResult result;
+
+	// annotate the variants collected so far and output them in input order
+	auto flush = [&]() {
+		annotator.Annotate(variants, result);
+		for (size_t i = 0; i < result.missingSequences_.size(); ++i) {
+			int chromId = variants.chromIds_[result.missingSequences_[i]];
+			std::cerr << "Can not found sequence '" << annotator.GetChromName(chromId) << "' in ref fasta" << std::endl;
+		}
+		if (result.unsorted_ && batch.unsorted_.empty()) {
+			size_t k = result.unsortedVariant_;
+			batch.unsorted_ = annotator.GetChromName(variants.chromIds_[k]) + ":" + std::to_string(variants.positions_[k] + 1);
+		}
+		size_t split = variants.GetCount();
+		for (size_t row = 0; row < result.GetCount(); ++row) {
+			if (result.variants_[row] != split) {
+				split = result.variants_[row];
+				fields.Split(batch.lines_[lines[split]], '\t', 6);
 			}
+			OutputAnnotation(fields, result, row, out);
 		}
-	} else {
-		assert(trans.strand_ == "-");
-		int cdsStartTxPos = GetTxPos(exons, cdsStart);
-		int cdsEndTxPos = GetTxPos(exons, cdsEnd - 1) + 1;
-
-		for (size_t i = exons.size(); i > 0; --i) {
-			int start = exons[i - 1].first;
-			int end = exons[i - 1].second;
-			if (pos >= cdsEnd) { // 5'-UTR
-				if (pos >= end) { // intron
-					if (i == exons.size() || (pos - end) < (exons[i].first - pos)) {
-						res = "c.-" + std::to_string(GetTxPos(exons, end - 1) - cdsEndTxPos + 1) + "-" + std::to_string(pos - end + 1);
-					} else {
-						res = "c.-" + std::to_string(GetTxPos(exons, exons[i].first) - cdsEndTxPos + 1) + "+" + std::to_string(exons[i].first - pos);
-					}
-					type = "Intron(" + std::to_string(exons.size() - i) + "/" + std::to_string(exons.size() - 1) + ")";
-					break;
-				} else if (pos >= start) { // exon
-					res = "c.-" + std::to_string(GetTxPos(exons, pos) - cdsEndTxPos + 1);
-					type = "Exon(" + std::to_string(exons.size() - i + 1) + "/" + std::to_string(exons.size()) + ")";
-					type2 = "5'-UTR";
-					break;
-				}
-			} else if (pos < cdsStart) { // 3'-UTR
-				if (pos >= end) { // intron
-					if (i == exons.size() || (pos - end) < (exons[i].first - pos)) {
-						res = "c.*" + std::to_string(cdsStartTxPos - GetTxPos(exons, end - 1)) + "-" + std::to_string(pos - end + 1);
-					} else {
-						res = "c.*" + std::to_string(cdsStartTxPos - GetTxPos(exons, exons[i].first)) + "+" + std::to_string(exons[i].first - pos);
-					}
-					type = "Intron(" + std::to_string(exons.size() - i) + "/" + std::to_string(exons.size() - 1) + ")";
-					break;
-				} else if (pos >= start) { // exon
-					res = "c.*" + std::to_string(cdsStartTxPos - GetTxPos(exons, pos));
-					type = "Exon(" + std::to_string(exons.size() - i + 1) + "/" + std::to_string(exons.size()) + ")";
-					type2 = "3'-UTR";
-					break;
-				}
-			} else { // CDS
-				if (pos >= end) { // intron
-					if (i == exons.size() || (pos - end) < (exons[i].first - pos)) {
-						res = "c." + std::to_string(cdsEndTxPos - GetTxPos(exons, end - 1)) + "-" + std::to_string(pos - end + 1);
-					} else {
-						res = "c." + std::to_string(cdsEndTxPos - GetTxPos(exons, exons[i].first)) + "+" + std::to_string(exons[i].first - pos);
-					}
-					type = "Intron(" + std::to_string(exons.size() - i) + "/" + std::to_string(exons.size() - 1) + ")";
-					break;
-				} else if (pos >= start) { // exon
-					int mutPos = cdsEndTxPos - GetTxPos(exons, pos) - 1;
-					res = "c." + std::to_string(mutPos + 1);
-					type = "Exon(" + std::to_string(exons.size() - i + 1) + "/" + std::to_string(exons.size()) + ")";
-					type2 = "CDS";
-
-					if (alt == "*") {
-						mutType = "Frameshift";
-					} else if (alt == ".") {
-						mutType = "Unknown";
-					} else if (alt.size() > 1) {
-						mutType = ((alt.size() - 2) % 3 == 0) ? "Inframe" : "Frameshift";
-					} else if (mutPos % 3 == 2) {
-						std::string base3 = CompBase(fa.GetSeq(chrom, trans.txStart_ + pos));
-
-						int pos2 = pos + 1;
-						int index = i - 1;
-						if (pos2 >= exons[index].second) {
-							++index;
-							assert(static_cast<size_t>(index) < exons.size());
-							pos2 = exons[index].first;
-						}
-						std::string base2 = CompBase(fa.GetSeq(chrom, trans.txStart_ + pos2));
-
-						int pos3 = pos2 + 1;
-						if (pos3 >= exons[index].second) {
-							++index;
-							assert(static_cast<size_t>(index) < exons.size());
-							pos3 = exons[index].first;
-						}
-						std::string base1 = CompBase(fa.GetSeq(chrom, trans.txStart_ + pos3));
-
-						codon1 = base1 + base2 + base3;
-						codon2 = base1 + base2 + CompBase(alt);
-						std::string aa1 = BaseToAA(codon1);
-						std::string aa2 = BaseToAA(codon2);
-						mutAA = "p." + aa1 + std::to_string(mutPos / 3 + 1) + aa2;
-						mutAA3 = "p." + BaseToAA3(codon1) + std::to_string(mutPos / 3 + 1) + BaseToAA3(codon2);
-						mutType = GetMutType(aa1, aa2);
-					} else if (mutPos % 3 == 1) {
-						std::string base2 = CompBase(fa.GetSeq(chrom, trans.txStart_ + pos));
-						int pos2 = pos - 1;
-						int index = i - 1;
-						if (pos2 < exons[index].first) {
-							assert(index > 0);
-							pos2 = exons[index - 1].second - 1;
-						}
-						std::string base3 = CompBase(fa.GetSeq(chrom, trans.txStart_ + pos2));
-
-						int pos3 = pos + 1;
-						index = i - 1;
-						if (pos3 >= exons[index].second) {
-							assert(index + 1 < static_cast<int>(exons.size()));
-							pos3 = exons[index + 1].first;
-						}
-						std::string base1 = CompBase(fa.GetSeq(chrom, trans.txStart_ + pos3));
-
-						codon1 = base1 + base2 + base3;
-						codon2 = base1 + CompBase(alt) + base3;
-						std::string aa1 = BaseToAA(codon1);
-						std::string aa2 = BaseToAA(codon2);
-						mutAA = "p." + aa1 + std::to_string(mutPos / 3 + 1) + aa2;
-						mutAA3 = "p." + BaseToAA3(codon1) + std::to_string(mutPos / 3 + 1) + BaseToAA3(codon2);
-						mutType = GetMutType(aa1, aa2);
-					} else {
-						std::string base1 = CompBase(fa.GetSeq(chrom, trans.txStart_ + pos));
-
-						int pos2 = pos - 1;
-						int index = i - 1;
-						if (pos2 < exons[index].first) {
-							--index;
-							assert(index >= 0);
-							pos2 = exons[index].second - 1;
-						}
-						std::string base2 = CompBase(fa.GetSeq(chrom, trans.txStart_ + pos2));
-
-						int pos3 = pos2 - 1;
-						if (pos3 < exons[index].first) {
-							--index;
-							assert(index >= 0);
-							pos3 = exons[index].second - 1;
-						}
-						std::string base3 = CompBase(fa.GetSeq(chrom, trans.txStart_ + pos3));
-
-						codon1 = base1 + base2 + base3;
-						codon2 = CompBase(alt) + base2 + base3;
-						std::string aa1 = BaseToAA(codon1);
-						std::string aa2 = BaseToAA(codon2);
-						mutAA = "p." + aa1 + std::to_string(mutPos / 3 + 1) + aa2;
-						mutAA3 = "p." + BaseToAA3(codon1) + std::to_string(mutPos / 3 + 1) + BaseToAA3(codon2);
-						mutType = GetMutType(aa1, aa2);
+		if (result.failed_) {
+			batch.failed_ = true;
+			batch.lineNo_ += lines[result.failedVariant_];
+			batch.error_ = result.error_;
+		}
+		variants.Clear();
+		lines.clear();
+		result.Clear();
+		return !batch.failed_;
+	};
+
+	for (size_t k = 0; k < batch.lines_.size(); ++k) {
+		size_t lineNo = batch.lineNo_ + k;
+		const std::string& line = batch.lines_[k];
+		if (tsvFile) {
+			if (line.empty() || line[0] == '#') continue;
+			if (lineNo == 1 && hasHeader) {
+				fields.Split(line, '\t');
+				OutputHeader(fields, 5, out);
+				continue;
+			}
+		} else {
+			if (line.empty()) continue;
+			if (line[0] == '#') {
+				if (line[1] == '#') continue;
+				if (hasHeader) {
+					if (!flush()) {
+						break;
 					}
-					break;
+					fields.Split(StringRef(line.data() + 1, line.size() - 1), '\t');
+					OutputHeader(fields, 5, out);
 				}
+				continue;
 			}
 		}
-	}
-
-	//assert(ref == seq.substr(pos, 1));
-	res += fa.GetSeq(chrom, trans.txStart_ + pos, ref.size()) + ">" + alt;
-
-	for (size_t i = 0; i + 1 < fields.size(); ++i) {
-		std::cout << fields[i] << "\t";
-	}
-	std::cout << trans.strand_ << "\t" << trans.name_ << "\t" << trans.name2_
-		<< "\t" << res << "\t" << type << "\t" << type2 << "\t" << codon1 << "\t" << codon2 << "\t" << mutAA << "\t" << mutAA3 << "\t" << mutType
-		<< "\t" << fields.back() << std::endl;
-	return true;
-}
-
-bool ProcessItem(const std::string& chrom, int pos, const std::string& alleleRef, const std::string& alleleAlt,
-		const std::map<std::string, std::vector<Transcript>>& data, const Fasta& fa,
-		const std::vector<std::string>& fields, bool outputFirstOnly)
-{
-	auto it = data.find(chrom);
-	if (it != data.end()) {
-		auto trans = it->second;
-		bool found = false;
-		for (size_t i = 0; i < trans.size(); ++i) {
-			if (pos >= trans[i].txStart_ && pos < trans[i].txEnd_) {
-				if (!fa.Has(chrom)) {
-					std::cerr << "Can not found sequence '" << chrom << "' in ref fasta" << std::endl;
-					return false;
-				}
 
-				Convert(chrom, trans[i], pos - trans[i].txStart_, alleleRef, alleleAlt, fa, fields);
-				found = true;
-				if (outputFirstOnly) {
-					break;
-				}
+		int genomePos;
+		if (fields.Split(line, '\t', 6) < 5 || !ParseInt(fields.GetField(1), genomePos)) {
+			if (flush()) {
+				batch.failed_ = true;
+				batch.lineNo_ = lineNo;
+				batch.error_ = "Invalid position";
 			}
+			break;
 		}
-		if (!found) {
-			for (size_t i = 0; i + 1 < fields.size(); ++i) {
-				std::cout << fields[i] << "\t";
-			}
-			std::cout << ".\t.\t.\t.\tIntergenic\t.\t.\t.\t.\t.\t.\t" << fields.back() << std::endl;
+		StringRef field = fields.GetField(0);
+		chrom.assign(field.Data(), field.Size());
+		int chromId = annotator.GetChromId(chrom);
+		if (chromId < 0) {
+			continue;
 		}
+		variants.Add(chromId, genomePos - 1, fields.GetField(3).ToString(), fields.GetField(4).ToString());
+		batch.positions_.push_back(std::make_pair(chromId, genomePos - 1));
+		lines.push_back(k);
 	}
-	return true;
-}
-
-static void OutputHeader(const std::vector<std::string>& fields, size_t insertPos)
-{
-	for (size_t i = 0; i < insertPos && i < fields.size(); ++i) {
-		std::cout << fields[i] << '\t';
-	}
-	std::cout << "strand\tname\tname2\tmutate\tsegment\ttype\tcodon1\tcodon2\tmutAA\tmutAA3\tmutType";
-	for (size_t i = insertPos; i < fields.size(); ++i) {
-		std::cout << '\t' << fields[i];
+	if (!batch.failed_) {
+		flush();
 	}
-	std::cout << std::endl;
+	return !batch.failed_;
 }
 
-static bool Process(const std::string& filename, bool tsvFile, bool hasHeader,
-		const std::map<std::string, std::vector<Transcript>>& data, const Fasta& fa, bool outputFirstOnly)
+static bool Process(const std::string& filename, bool tsvFile, bool hasHeader, const Annotator& annotator,
+		const TranscriptIndex& index, bool sortedInput, int threads)
 {
 	std::ifstream file(filename, std::ios::in);
 	if (!file.is_open()) {
@@ -569,48 +168,51 @@ static bool Process(const std::string& filename, bool tsvFile, bool hasHeader,
 		return false;
 	}
 
-	std::vector<std::string> fields;
+	Output out(STDOUT_FILENO);
 	size_t lineNo = 0;
-	std::string line;
-	while (std::getline(file, line)) {
-		++lineNo;
-		if (tsvFile) {
-			if (line.empty() || line[0] == '#') continue;
-			if (lineNo == 1 && hasHeader) {
-				fields = Split(line, "\t");
-				OutputHeader(fields, 5);
-				continue;
+	bool reported = false;
+	PositionOrder order(index.GetCount()); // continues across batches
+	auto read = [&](Batch& batch) {
+		batch.lineNo_ = lineNo + 1;
+		std::string line;
+		while (batch.lines_.size() < BATCH_SIZE && std::getline(file, line)) {
+			++lineNo;
+			batch.lines_.push_back(line);
+		}
+		return !batch.lines_.empty();
+	};
+	auto work = [&](Batch& batch) {
+		ProcessBatch(batch, tsvFile, hasHeader, annotator);
+	};
+	auto write = [&](Batch& batch) {
+		if (sortedInput && !reported) {
+			// the sweep of a batch starts afresh, so its results are right
+			// even if the input goes backwards between batches
+			if (!batch.unsorted_.empty()) {
+				std::cerr << "Warning: Input is not sorted at " << batch.unsorted_ << ", fall back to indexed lookup" << std::endl;
+				reported = true;
 			}
-		} else {
-			if (line.empty()) continue;
-			if (line[0] == '#') {
-				if (line[1] == '#') continue;
-				if (hasHeader) {
-					fields = Split(line.substr(1), "\t");
-					OutputHeader(fields, 5);
+			for (size_t i = 0; i < batch.positions_.size() && !reported; ++i) {
+				int chromId = batch.positions_[i].first;
+				int pos = batch.positions_[i].second;
+				if (!order.Next(chromId, pos)) {
+					std::cerr << "Warning: Input is not sorted at " << index.GetName(chromId) << ":" << pos + 1 << std::endl;
+					reported = true;
 				}
-				continue;
 			}
 		}
-
-		try {
-			fields = Split(line, "\t", 6);
-
-			std::string chrom = fields[0];
-			int genomePos = std::stoi(fields[1]);
-			std::string alleleRef = fields[3];
-			std::string alleleAlt = fields[4];
-
-			ProcessItem(chrom, genomePos - 1, alleleRef, alleleAlt, data, fa, fields, outputFirstOnly);
-		} catch (const std::exception& e) {
-			std::cerr << "Unexpected error in line " << lineNo << " of file '" << filename << "'! " << e.what() << std::endl;
-			file.close();
+		out << batch.output_.Str();
+		if (batch.failed_) {
+			out.Flush();
+			std::cerr << "Unexpected error in line " << batch.lineNo_ << " of file '" << filename << "'! " << batch.error_ << std::endl;
 			return false;
 		}
-	}
+		return true;
+	};
+	bool ok = RunPipeline<Batch>(threads, read, work, write);
 
 	file.close();
-	return true;
+	return ok;
 }
 
 static void PrintUsage()
@@ -620,13 +222,19 @@ static void PrintUsage()
 		"\n"
 		"Input:\n"
 		"   <x.vcf>         input SNV list in VCF format\n"
-		"   <refGene.tsv>   track data downloaded from UCSC table browser\n"
-		"   <ref.fa>        reference genome in FASTA format\n"
+		"   <refGene.tsv>   track data downloaded from UCSC table browser, or compiled\n"
+		"                   by refgene-compile\n"
+		"   <ref.fa>        reference genome in FASTA format, or packed by fasta-pack\n"
+		"\n"
+		"Transcripts on chrM/MT are translated by the vertebrate mitochondrial code.\n"
 		"\n"
 		"Options:\n"
 		"   -1              output only first matched script, default to output all\n"
 		"   -T              TSV input, with columns: chrom, start, end, ref, alt...\n"
 		"   -H              input file has header, output with header\n"
+		"   -P              keep reference packed in memory (2 bits per base)\n"
+		"   --sorted        input is sorted by position, annotate in a single sweep\n"
+		"   -t <N>          number of threads, default: 1\n"
 		<< std::endl;
 }
 
@@ -638,6 +246,9 @@ int Annotate_main(int argc, char* const argv[])
 	std::string refFastaFile;
 	bool tsvInput = false;
 	bool hasHeader = false;
+	bool packed = false;
+	bool sortedInput = false;
+	int threads = 1;
 
 	std::vector<std::string> args(argv, argv + argc);
 	std::vector<std::string> restArgs;
@@ -648,6 +259,16 @@ int Annotate_main(int argc, char* const argv[])
 			tsvInput = true;
 		} else if (args[i] == "-H") {
 			hasHeader = true;
+		} else if (args[i] == "-P") {
+			packed = true;
+		} else if (args[i] == "--sorted") {
+			sortedInput = true;
+		} else if (args[i] == "-t" && i + 1 < args.size()) {
+			threads = atoi(args[++i].c_str());
+			if (threads < 1) {
+				std::cerr << "Error: Invalid thread number '" << args[i] << "'!" << std::endl;
+				return 1;
+			}
 		} else {
 			restArgs.push_back(args[i]);
 		}
@@ -661,16 +282,19 @@ int Annotate_main(int argc, char* const argv[])
 	refFastaFile = restArgs[2];
 
 	Fasta fa;
-	if (!fa.Load(refFastaFile)) {
+	if (!fa.Load(refFastaFile, false, packed)) {
 		return 1;
 	}
 
-	std::map<std::string, std::vector<Transcript>> data;
-	if (!LoadRefGene(refGeneFile, data)) {
+	TranscriptIndex index;
+	if (!index.Load(refGeneFile)) {
 		return 1;
 	}
 
-	if (!Process(inputFile, tsvInput, hasHeader, data, fa, outputFirstOnly)) {
+	Annotator annotator(fa, index);
+	annotator.SetFirstOnly(outputFirstOnly);
+	annotator.SetSortedInput(sortedInput);
+	if (!Process(inputFile, tsvInput, hasHeader, annotator, index, sortedInput, threads)) {
 		return 1;
 	}
 	return 0;
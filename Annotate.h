@@ -1,6 +1,16 @@
 #ifndef __ANNOTATE_H__
 #define __ANNOTATE_H__
 
+#include <cstddef>
+
+class LineSplit;
+class Output;
+struct AnnotationResult;
+
 int Annotate_main(int argc, char* const argv[]);
 
+// append a row of result in the columns of the input line, as split by tab
+// into at most 6 fields; the ones after 'alt' stay last
+void OutputAnnotation(const LineSplit& fields, const AnnotationResult& result, size_t row, Output& out);
+
 #endif
@@ -0,0 +1,474 @@
+#include <list>
+#include <unordered_map>
+#include <cassert>
+#include <algorithm>
+#include <stdexcept>
+#include "Annotator.h"
+#include "GeneticCode.h"
+
+void VariantBatch::Clear()
+{
+	chromIds_.clear();
+	positions_.clear();
+	refs_.clear();
+	alts_.clear();
+}
+
+void VariantBatch::Add(int chromId, int pos, const std::string& ref, const std::string& alt)
+{
+	chromIds_.push_back(chromId);
+	positions_.push_back(pos);
+	refs_.push_back(ref);
+	alts_.push_back(alt);
+}
+
+const char* GetSegmentName(Segment segment)
+{
+	switch (segment) {
+	case SEGMENT_INTERGENIC: return "Intergenic";
+	case SEGMENT_EXON: return "Exon";
+	case SEGMENT_INTRON: return "Intron";
+	default: return ".";
+	}
+}
+
+const char* GetRegionName(Region region)
+{
+	switch (region) {
+	case REGION_UTR5: return "5'-UTR";
+	case REGION_CDS: return "CDS";
+	case REGION_UTR3: return "3'-UTR";
+	default: return ".";
+	}
+}
+
+const char* GetMutTypeName(MutType mutType)
+{
+	switch (mutType) {
+	case MUT_UNKNOWN: return "Unknown";
+	case MUT_SYNONYMOUS: return "Synonymous";
+	case MUT_NON_SYNONYMOUS: return "Non-synonymous";
+	case MUT_STOP_GAIN: return "Stop-codon-gain";
+	case MUT_STOP_LOSS: return "Stop-codon-loss";
+	case MUT_FRAMESHIFT: return "Frameshift";
+	case MUT_INFRAME: return "Inframe";
+	default: return ".";
+	}
+}
+
+void AnnotationResult::Clear()
+{
+	variants_.clear();
+	transcripts_.clear();
+	segments_.clear();
+	segmentNumbers_.clear();
+	regions_.clear();
+	hgvsC_.clear();
+	codons1_.clear();
+	codons2_.clear();
+	hgvsP_.clear();
+	hgvsP3_.clear();
+	mutTypes_.clear();
+	missingSequences_.clear();
+	unsorted_ = false;
+	unsortedVariant_ = 0;
+	failed_ = false;
+	failedVariant_ = 0;
+	error_.clear();
+}
+
+void AnnotationResult::Resize(size_t rows)
+{
+	variants_.resize(rows);
+	transcripts_.resize(rows);
+	segments_.resize(rows);
+	segmentNumbers_.resize(rows);
+	regions_.resize(rows);
+	hgvsC_.resize(rows);
+	codons1_.resize(rows);
+	codons2_.resize(rows);
+	hgvsP_.resize(rows);
+	hgvsP3_.resize(rows);
+	mutTypes_.resize(rows);
+}
+
+size_t AnnotationResult::AddRow(size_t variant, const Transcript* trans)
+{
+	variants_.push_back(variant);
+	transcripts_.push_back(trans);
+	segments_.push_back(trans ? SEGMENT_NONE : SEGMENT_INTERGENIC);
+	segmentNumbers_.push_back(0);
+	regions_.push_back(REGION_NONE);
+	hgvsC_.push_back(std::string());
+	codons1_.push_back(std::string());
+	codons2_.push_back(std::string());
+	hgvsP_.push_back(std::string());
+	hgvsP3_.push_back(std::string());
+	mutTypes_.push_back(MUT_NONE);
+	return variants_.size() - 1;
+}
+
+// Spliced transcript sequences in coding orientation (reverse complemented
+// on the minus strand), built on first use so that the codon of a coding SNV
+// is a plain index. Bounded, the least recently used transcript is dropped
+// first; used by one worker at a time.
+class TranscriptSeqCache
+{
+public:
+	explicit TranscriptSeqCache(size_t capacity = 1024): capacity_(capacity) { }
+
+	struct Entry
+	{
+		std::string seq_; // the whole spliced transcript, UTRs included
+		size_t cdsOffset_; // of the first CDS base in seq_
+	};
+
+	const Entry& Get(const Fasta& fa, size_t seqId, const Transcript& trans)
+	{
+		auto it = index_.find(&trans);
+		if (it != index_.end()) {
+			entries_.splice(entries_.begin(), entries_, it->second);
+			return it->second->second;
+		}
+		if (entries_.size() >= capacity_) {
+			index_.erase(entries_.back().first);
+			entries_.pop_back();
+		}
+		entries_.emplace_front(&trans, Entry());
+		index_[&trans] = entries_.begin();
+		Entry& entry = entries_.front().second;
+		Build(fa, seqId, trans, entry);
+		return entry;
+	}
+private:
+	static void Build(const Fasta& fa, size_t seqId, const Transcript& trans, Entry& entry)
+	{
+		const auto& exons = trans.exons_;
+		size_t length = exons.empty() ? 0 : trans.exonOffsets_.back() + exons.back().second - exons.back().first;
+		entry.seq_.assign(length, '\0'); // bases past the sequence end
+		for (size_t i = 0; i < exons.size(); ++i) {
+			fa.GetSeq(seqId, trans.txStart_ + exons[i].first, exons[i].second - exons[i].first, &entry.seq_[trans.exonOffsets_[i]]);
+		}
+		if (trans.strand_ == "-") {
+			std::reverse(entry.seq_.begin(), entry.seq_.end());
+			for (size_t i = 0; i < entry.seq_.size(); ++i) {
+				entry.seq_[i] = ComplementBase(entry.seq_[i]);
+			}
+			entry.cdsOffset_ = length - trans.cdsEndTxPos_;
+		} else {
+			entry.cdsOffset_ = trans.cdsStartTxPos_;
+		}
+	}
+
+	typedef std::list<std::pair<const Transcript*, Entry>> Entries;
+	Entries entries_; // most recently used first
+	std::unordered_map<const Transcript*, Entries::iterator> index_;
+	size_t capacity_;
+};
+
+static MutType GetMutType(char aa1, char aa2)
+{
+	if (aa1 == 'X' || aa2 == 'X') {
+		return MUT_UNKNOWN;
+	} else if (aa1 == aa2) {
+		return MUT_SYNONYMOUS;
+	} else if (aa1 == '*') {
+		return MUT_STOP_LOSS;
+	} else if (aa2 == '*') {
+		return MUT_STOP_GAIN;
+	} else {
+		return MUT_NON_SYNONYMOUS;
+	}
+}
+
+// codon change of a SNV at mutPos of the CDS, alt is on the coding strand; false
+// (with nothing set) if the codon runs past the end of the transcript
+static bool TranslateSnv(const std::string& seq, size_t cdsOffset, int mutPos, char alt, const GeneticCode& code,
+		std::string& codon1, std::string& codon2, std::string& mutAA, std::string& mutAA3, MutType& mutType)
+{
+	size_t offset = cdsOffset + mutPos / 3 * 3;
+	if (offset + 3 > seq.size()) {
+		return false;
+	}
+	char ref[3] = { seq[offset], seq[offset + 1], seq[offset + 2] };
+	char mut[3] = { ref[0], ref[1], ref[2] };
+	mut[mutPos % 3] = alt;
+	char aa1 = code.Translate(ref);
+	char aa2 = code.Translate(mut);
+
+	char digits[16]; // 1-based codon number, filled from the end
+	char* end = digits + sizeof(digits);
+	char* aaPos = end;
+	for (int n = mutPos / 3 + 1; n > 0; n /= 10) {
+		*--aaPos = static_cast<char>('0' + n % 10);
+	}
+
+	codon1.assign(ref, 3);
+	codon2.assign(mut, 3);
+	mutAA.assign("p.").append(1, aa1).append(aaPos, end).append(1, aa2);
+	mutAA3.assign("p.").append(GeneticCode::GetName3(aa1)).append(aaPos, end).append(GeneticCode::GetName3(aa2));
+	mutType = GetMutType(aa1, aa2);
+	return true;
+}
+
+// mutation type of an alt allele in the CDS other than a SNV, MUT_NONE for a SNV
+static MutType GetIndelType(const std::string& alt)
+{
+	if (alt == "*") {
+		return MUT_FRAMESHIFT;
+	} else if (alt == ".") {
+		return MUT_UNKNOWN;
+	} else if (alt.size() > 1) {
+		return ((alt.size() - 2) % 3 == 0) ? MUT_INFRAME : MUT_FRAMESHIFT;
+	}
+	return MUT_NONE;
+}
+
+// annotate a variant at pos (relative to txStart_) in row of result
+static void Convert(size_t seqId, const Transcript& trans, int pos, const std::string& ref, const std::string& alt,
+		const Fasta& fa, const GeneticCode& code, TranscriptSeqCache& cache, std::string& buffer,
+		AnnotationResult& result, size_t row)
+{
+	std::string& res = result.hgvsC_[row];
+	Segment& segment = result.segments_[row];
+	int& number = result.segmentNumbers_[row];
+	Region& region = result.regions_[row];
+	MutType& mutType = result.mutTypes_[row];
+
+	const auto& exons = trans.exons_;
+	int cdsStart = trans.cdsStart_ - trans.txStart_;
+	int cdsEnd = trans.cdsEnd_ - trans.txStart_;
+
+	int cdsStartTxPos = trans.cdsStartTxPos_;
+	int cdsEndTxPos = trans.cdsEndTxPos_;
+	if (cdsStart != cdsEnd && cdsStartTxPos < 0) {
+		throw std::runtime_error("CDS of transcript '" + trans.name_ + "' is not in its exons");
+	}
+
+	int mutPos = -1; // in the CDS, for coding SNVs
+	if (cdsStart == cdsEnd) {
+		mutType = MUT_UNKNOWN;
+	} else if (trans.strand_ == "+") {
+		// first exon ending after pos, the earlier ones can not match
+		size_t first = std::upper_bound(exons.begin(), exons.end(), pos, [](int p, const std::pair<int, int>& exon) {
+				return p < exon.second;
+			}) - exons.begin();
+		for (size_t i = first; i < exons.size(); ++i) {
+			int start = exons[i].first;
+			int end = exons[i].second;
+			if (pos < cdsStart) { // 5'-UTR
+				if (pos < start) { // intron
+					if (i == 0 || (pos - exons[i - 1].second) > (start - pos)) {
+						res = "c.-" + std::to_string(cdsStartTxPos - trans.GetTxPos(start)) + "-" + std::to_string(start - pos);
+					} else {
+						res = "c.-" + std::to_string(cdsStartTxPos - trans.GetTxPos(exons[i - 1].second - 1)) + "+" + std::to_string(pos - (exons[i - 1].second - 1));
+					}
+					segment = SEGMENT_INTRON;
+					number = i;
+					break;
+				} else if (pos < end) { // exon
+					res = "c.-" + std::to_string(cdsStartTxPos - trans.GetTxPos(pos));
+					segment = SEGMENT_EXON;
+					number = i + 1;
+					region = REGION_UTR5;
+					break;
+				}
+			} else if (pos >= cdsEnd) { // 3'-UTR
+				if (pos < start) { // intron
+					if (i == 0 || (pos - exons[i - 1].second) > (start - pos)) {
+						res = "c.*" + std::to_string(trans.GetTxPos(start) - cdsEndTxPos + 1) + "-" + std::to_string(start - pos);
+					} else {
+						res = "c.*" + std::to_string(trans.GetTxPos(exons[i - 1].second - 1) - cdsEndTxPos + 1) + "+" + std::to_string(pos - (exons[i - 1].second - 1));
+					}
+					segment = SEGMENT_INTRON;
+					number = i;
+					break;
+				} else if (pos < end) { // exon
+					res = "c.*" + std::to_string(trans.GetTxPos(pos) - cdsEndTxPos + 1);
+					segment = SEGMENT_EXON;
+					number = i + 1;
+					region = REGION_UTR3;
+					break;
+				}
+			} else { // CDS
+				if (pos < start) { // intron
+					if (i == 0 || (pos - exons[i - 1].second) > (start - pos)) {
+						res = "c." + std::to_string(trans.GetTxPos(start) - cdsStartTxPos + 1) + "-" + std::to_string(start - pos);
+					} else {
+						res = "c." + std::to_string(trans.GetTxPos(exons[i - 1].second - 1) - cdsStartTxPos + 1) + "+" + std::to_string(pos - (exons[i - 1].second - 1));
+					}
+					segment = SEGMENT_INTRON;
+					number = i;
+					break;
+				} else if (pos < end) { // exon
+					mutPos = trans.GetTxPos(pos) - cdsStartTxPos;
+					res = "c." + std::to_string(mutPos + 1);
+					segment = SEGMENT_EXON;
+					number = i + 1;
+					region = REGION_CDS;
+					break;
+				}
+			}
+		}
+	} else {
+		assert(trans.strand_ == "-");
+		// after the last exon starting at or before pos, the later ones can not match
+		size_t last = std::upper_bound(exons.begin(), exons.end(), pos, [](int p, const std::pair<int, int>& exon) {
+				return p < exon.first;
+			}) - exons.begin();
+		for (size_t i = last; i > 0; --i) {
+			int start = exons[i - 1].first;
+			int end = exons[i - 1].second;
+			if (pos >= cdsEnd) { // 5'-UTR
+				if (pos >= end) { // intron
+					if (i == exons.size() || (pos - end) < (exons[i].first - pos)) {
+						res = "c.-" + std::to_string(trans.GetTxPos(end - 1) - cdsEndTxPos + 1) + "-" + std::to_string(pos - end + 1);
+					} else {
+						res = "c.-" + std::to_string(trans.GetTxPos(exons[i].first) - cdsEndTxPos + 1) + "+" + std::to_string(exons[i].first - pos);
+					}
+					segment = SEGMENT_INTRON;
+					number = exons.size() - i;
+					break;
+				} else if (pos >= start) { // exon
+					res = "c.-" + std::to_string(trans.GetTxPos(pos) - cdsEndTxPos + 1);
+					segment = SEGMENT_EXON;
+					number = exons.size() - i + 1;
+					region = REGION_UTR5;
+					break;
+				}
+			} else if (pos < cdsStart) { // 3'-UTR
+				if (pos >= end) { // intron
+					if (i == exons.size() || (pos - end) < (exons[i].first - pos)) {
+						res = "c.*" + std::to_string(cdsStartTxPos - trans.GetTxPos(end - 1)) + "-" + std::to_string(pos - end + 1);
+					} else {
+						res = "c.*" + std::to_string(cdsStartTxPos - trans.GetTxPos(exons[i].first)) + "+" + std::to_string(exons[i].first - pos);
+					}
+					segment = SEGMENT_INTRON;
+					number = exons.size() - i;
+					break;
+				} else if (pos >= start) { // exon
+					res = "c.*" + std::to_string(cdsStartTxPos - trans.GetTxPos(pos));
+					segment = SEGMENT_EXON;
+					number = exons.size() - i + 1;
+					region = REGION_UTR3;
+					break;
+				}
+			} else { // CDS
+				if (pos >= end) { // intron
+					if (i == exons.size() || (pos - end) < (exons[i].first - pos)) {
+						res = "c." + std::to_string(cdsEndTxPos - trans.GetTxPos(end - 1)) + "-" + std::to_string(pos - end + 1);
+					} else {
+						res = "c." + std::to_string(cdsEndTxPos - trans.GetTxPos(exons[i].first)) + "+" + std::to_string(exons[i].first - pos);
+					}
+					segment = SEGMENT_INTRON;
+					number = exons.size() - i;
+					break;
+				} else if (pos >= start) { // exon
+					mutPos = cdsEndTxPos - trans.GetTxPos(pos) - 1;
+					res = "c." + std::to_string(mutPos + 1);
+					segment = SEGMENT_EXON;
+					number = exons.size() - i + 1;
+					region = REGION_CDS;
+					break;
+				}
+			}
+		}
+	}
+
+	if (mutPos >= 0) {
+		mutType = GetIndelType(alt);
+		if (mutType == MUT_NONE) {
+			const TranscriptSeqCache::Entry& entry = cache.Get(fa, seqId, trans);
+			char base = (trans.strand_ == "-" ? ComplementBase(alt[0]) : alt[0]);
+			if (!TranslateSnv(entry.seq_, entry.cdsOffset_, mutPos, base, code, result.codons1_[row], result.codons2_[row],
+					result.hgvsP_[row], result.hgvsP3_[row], mutType)) {
+				mutType = MUT_UNKNOWN; // the CDS is cut short, e.g. an incomplete transcript
+			}
+		}
+	}
+
+	if (res.empty()) {
+		res = ".";
+	}
+	StringRef refSeq = fa.GetView(seqId, trans.txStart_ + pos, ref.size(), buffer);
+	res.append(refSeq.Data(), refSeq.Size());
+	res += ">" + alt;
+}
+
+Annotator::Annotator(const Fasta& fa, const TranscriptIndex& index):
+	fa_(fa), index_(index), firstOnly_(false), sortedInput_(false)
+{
+	for (size_t i = 0; i < index.GetCount(); ++i) {
+		seqIds_.push_back(fa.GetId(index.GetName(i)));
+	}
+}
+
+Annotator::~Annotator()
+{
+}
+
+bool Annotator::Annotate(const VariantBatch& batch, AnnotationResult& result) const
+{
+	std::unique_ptr<TranscriptSeqCache> cache;
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex_);
+		if (!caches_.empty()) {
+			cache = std::move(caches_.back());
+			caches_.pop_back();
+		}
+	}
+	if (!cache) {
+		cache.reset(new TranscriptSeqCache);
+	}
+
+	TranscriptSweep sweep(index_);
+	TranscriptSweep* sweeping = (sortedInput_ ? &sweep : NULL);
+	std::vector<const Transcript*> hits;
+	std::string buffer;
+	for (size_t k = 0; k < batch.GetCount(); ++k) {
+		int chromId = batch.chromIds_[k];
+		int pos = batch.positions_[k];
+		if (chromId < 0) {
+			continue;
+		}
+		if (sweeping && !sweeping->Find(chromId, pos, hits)) {
+			result.unsorted_ = true;
+			result.unsortedVariant_ = k;
+			sweeping = NULL;
+		}
+		if (!sweeping) {
+			index_.Find(chromId, pos, pos + 1, hits);
+		}
+		if (hits.empty()) {
+			result.AddRow(k, NULL);
+			continue;
+		}
+		int seqId = seqIds_[chromId];
+		if (seqId < 0) {
+			result.missingSequences_.push_back(k);
+			continue;
+		}
+
+		const GeneticCode& code = GeneticCode::ForChrom(index_.GetName(chromId));
+		try {
+			for (size_t i = 0; i < hits.size(); ++i) {
+				size_t row = result.AddRow(k, hits[i]);
+				Convert(seqId, *hits[i], pos - hits[i]->txStart_, batch.refs_[k], batch.alts_[k],
+						fa_, code, *cache, buffer, result, row);
+				if (firstOnly_) {
+					break;
+				}
+			}
+		} catch (const std::exception& e) {
+			result.Resize(result.GetCount() - 1); // the row that failed
+			result.failed_ = true;
+			result.failedVariant_ = k;
+			result.error_ = e.what();
+			break;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(cacheMutex_);
+	caches_.push_back(std::move(cache));
+	return !result.failed_;
+}
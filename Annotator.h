@@ -0,0 +1,139 @@
+#ifndef __ANNOTATOR_H__
+#define __ANNOTATOR_H__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "Fasta.h"
+#include "Transcript.h"
+#include "TranscriptIndex.h"
+
+class TranscriptSeqCache;
+
+// variants to annotate, one per index
+struct VariantBatch
+{
+	void Clear();
+	void Add(int chromId, int pos, const std::string& ref, const std::string& alt);
+	size_t GetCount() const { return chromIds_.size(); }
+
+	std::vector<int> chromIds_;  // by Annotator::GetChromId()
+	std::vector<int> positions_; // 0-based
+	std::vector<std::string> refs_;
+	std::vector<std::string> alts_; // '*' or '.' as in VCF, longer for indels
+};
+
+enum Segment
+{
+	SEGMENT_NONE,
+	SEGMENT_INTERGENIC,
+	SEGMENT_EXON,
+	SEGMENT_INTRON
+};
+
+enum Region
+{
+	REGION_NONE,
+	REGION_UTR5,
+	REGION_CDS,
+	REGION_UTR3
+};
+
+enum MutType
+{
+	MUT_NONE,
+	MUT_UNKNOWN,
+	MUT_SYNONYMOUS,
+	MUT_NON_SYNONYMOUS,
+	MUT_STOP_GAIN,
+	MUT_STOP_LOSS,
+	MUT_FRAMESHIFT,
+	MUT_INFRAME
+};
+
+// names as printed by 'crabber annotate', "." for none
+const char* GetSegmentName(Segment segment);
+const char* GetRegionName(Region region);
+const char* GetMutTypeName(MutType mutType);
+
+// Annotations of a batch in columns, one row per transcript hit by a variant
+// (or a single intergenic row), rows of a variant are adjacent and variants
+// in batch order. String columns are empty where not applicable.
+struct AnnotationResult
+{
+	AnnotationResult(): unsorted_(false), unsortedVariant_(0), failed_(false), failedVariant_(0) { }
+
+	void Clear();
+	size_t GetCount() const { return variants_.size(); }
+
+	std::vector<size_t> variants_;               // index in the batch
+	std::vector<const Transcript*> transcripts_; // NULL for intergenic
+	std::vector<Segment> segments_;
+	std::vector<int> segmentNumbers_; // exon or intron number in transcript direction
+	std::vector<Region> regions_;
+	std::vector<std::string> hgvsC_;  // e.g. c.45C>T
+	std::vector<std::string> codons1_;
+	std::vector<std::string> codons2_;
+	std::vector<std::string> hgvsP_;  // e.g. p.S15L
+	std::vector<std::string> hgvsP3_; // e.g. p.Ser15Leu
+	std::vector<MutType> mutTypes_;
+
+	// variants hit by transcripts on a chromosome missing from the reference,
+	// they have no rows
+	std::vector<size_t> missingSequences_;
+
+	// set in sorted mode when the batch is not sorted at unsortedVariant_,
+	// it and the variants after it are found by indexed lookup
+	bool unsorted_;
+	size_t unsortedVariant_;
+
+	// set when a variant could not be annotated, the batch stops at it (rows
+	// of the transcripts done before are kept)
+	bool failed_;
+	size_t failedVariant_;
+	std::string error_;
+private:
+	friend class Annotator;
+
+	size_t AddRow(size_t variant, const Transcript* trans);
+	void Resize(size_t rows);
+};
+
+// Annotation of variants against transcripts on a reference genome. The
+// reference and the index must outlive the annotator. Annotate() may be
+// called from several threads at once.
+class Annotator
+{
+public:
+	Annotator(const Fasta& fa, const TranscriptIndex& index);
+	~Annotator();
+
+	// chromosome id for VariantBatch, -1 if it has no transcripts (such
+	// variants are not annotated at all)
+	int GetChromId(const std::string& chrom) const { return index_.GetId(chrom); }
+	const std::string& GetChromName(size_t chromId) const { return index_.GetName(chromId); }
+
+	// only the first transcript hit by each variant, default to all
+	void SetFirstOnly(bool firstOnly) { firstOnly_ = firstOnly; }
+	// variants of a batch are sorted by position, found in a single sweep
+	void SetSortedInput(bool sortedInput) { sortedInput_ = sortedInput; }
+
+	// append the annotations of batch to result, false if it failed
+	bool Annotate(const VariantBatch& batch, AnnotationResult& result) const;
+private:
+	Annotator(const Annotator&);
+	Annotator& operator=(const Annotator&);
+
+	const Fasta& fa_;
+	const TranscriptIndex& index_;
+	std::vector<int> seqIds_; // reference sequence of each chromosome, or -1
+	bool firstOnly_;
+	bool sortedInput_;
+
+	// idle sequence caches, so that hot transcripts stay cached across batches
+	mutable std::mutex cacheMutex_;
+	mutable std::vector<std::unique_ptr<TranscriptSeqCache>> caches_;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#include "BaseCount.h"
+#include "GeneticCode.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// total by base code (TCAG order, then N)
+static void AddCounts(const uint64_t* total, BaseCounts& counts)
+{
+	counts.t_ += total[0];
+	counts.c_ += total[1];
+	counts.a_ += total[2];
+	counts.g_ += total[3];
+	counts.n_ += total[BASE_CODE_N];
+}
+
+static void CountScalar(const char* data, size_t size, BaseCounts& counts)
+{
+	const unsigned char* codes = GetBaseCodes();
+	uint64_t total[BASE_CODE_OTHER + 1] = { 0 };
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i) {
+		++total[codes[p[i]]];
+	}
+	AddCounts(total, counts);
+}
+
+#if defined(__x86_64__)
+// Both kernels lower-case each block by setting bit 0x20 (only 'A' and 'a'
+// become 'a', and so on), compare it with each base and subtract the 0/-1
+// masks from byte counters, which are summed into 64 bits every 255 blocks
+// before they can wrap.
+
+static void CountSse2(const char* data, size_t size, BaseCounts& counts)
+{
+	const __m128i lower = _mm_set1_epi8(0x20);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i keys[5] = {
+		_mm_set1_epi8('t'), _mm_set1_epi8('c'), _mm_set1_epi8('a'), _mm_set1_epi8('g'), _mm_set1_epi8('n')
+	};
+	uint64_t total[5] = { 0 };
+	size_t i = 0;
+	while (size - i >= 16) {
+		__m128i acc[5] = { zero, zero, zero, zero, zero };
+		size_t blocks = (size - i) / 16;
+		if (blocks > 255) {
+			blocks = 255;
+		}
+		for (size_t b = 0; b < blocks; ++b, i += 16) {
+			__m128i v = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), lower);
+			for (int k = 0; k < 5; ++k) {
+				acc[k] = _mm_sub_epi8(acc[k], _mm_cmpeq_epi8(v, keys[k]));
+			}
+		}
+		for (int k = 0; k < 5; ++k) {
+			__m128i sum = _mm_sad_epu8(acc[k], zero);
+			total[k] += _mm_cvtsi128_si64(sum) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sum, sum));
+		}
+	}
+	AddCounts(total, counts);
+	CountScalar(data + i, size - i, counts);
+}
+
+__attribute__((target("avx2")))
+static void CountAvx2(const char* data, size_t size, BaseCounts& counts)
+{
+	const __m256i lower = _mm256_set1_epi8(0x20);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i keys[5] = {
+		_mm256_set1_epi8('t'), _mm256_set1_epi8('c'), _mm256_set1_epi8('a'), _mm256_set1_epi8('g'), _mm256_set1_epi8('n')
+	};
+	uint64_t total[5] = { 0 };
+	size_t i = 0;
+	while (size - i >= 32) {
+		__m256i acc[5] = { zero, zero, zero, zero, zero };
+		size_t blocks = (size - i) / 32;
+		if (blocks > 255) {
+			blocks = 255;
+		}
+		for (size_t b = 0; b < blocks; ++b, i += 32) {
+			__m256i v = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), lower);
+			for (int k = 0; k < 5; ++k) {
+				acc[k] = _mm256_sub_epi8(acc[k], _mm256_cmpeq_epi8(v, keys[k]));
+			}
+		}
+		for (int k = 0; k < 5; ++k) {
+			__m256i sum = _mm256_sad_epu8(acc[k], zero);
+			total[k] += _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1)
+				+ _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+		}
+	}
+	AddCounts(total, counts);
+	CountSse2(data + i, size - i, counts);
+}
+#endif
+
+BaseCountKernel GetBaseCountKernel(const std::string& name)
+{
+	if (name == "scalar") {
+		return CountScalar;
+	}
+#if defined(__x86_64__)
+	if (name == "sse2") {
+		return CountSse2;
+	}
+	__builtin_cpu_init(); // may run before static constructors
+	if (name == "avx2" && __builtin_cpu_supports("avx2")) {
+		return CountAvx2;
+	}
+#endif
+	return NULL;
+}
+
+static const char* ChooseKernel()
+{
+	if (GetBaseCountKernel("avx2")) {
+		return "avx2";
+	}
+	if (GetBaseCountKernel("sse2")) {
+		return "sse2";
+	}
+	return "scalar";
+}
+
+static const char* KERNEL_NAME = ChooseKernel();
+static const BaseCountKernel KERNEL = GetBaseCountKernel(KERNEL_NAME);
+
+void CountBases(const char* data, size_t size, BaseCounts& counts)
+{
+	KERNEL(data, size, counts);
+}
+
+const char* GetBaseCountKernelName()
+{
+	return KERNEL_NAME;
+}
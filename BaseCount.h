@@ -0,0 +1,31 @@
+#ifndef __BASE_COUNT_H__
+#define __BASE_COUNT_H__
+
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+struct BaseCounts
+{
+	BaseCounts(): a_(0), c_(0), g_(0), t_(0), n_(0) { }
+
+	uint64_t a_;
+	uint64_t c_;
+	uint64_t g_;
+	uint64_t t_;
+	uint64_t n_;
+};
+
+// Add the number of A, C, G, T and N (either case) in data to counts. Any
+// other byte, e.g. IUPAC codes or line breaks, is not counted, so callers
+// get other bases by subtracting from the number of bases. Uses the fastest
+// kernel this CPU supports (AVX2, SSE2 or scalar), chosen once at startup.
+void CountBases(const char* data, size_t size, BaseCounts& counts);
+
+typedef void (*BaseCountKernel)(const char* data, size_t size, BaseCounts& counts);
+
+// kernel by name ("scalar", "sse2" or "avx2"), NULL if this CPU lacks it
+BaseCountKernel GetBaseCountKernel(const std::string& name);
+const char* GetBaseCountKernelName();
+
+#endif
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <algorithm>
+#include "String.h"
+#include "Fasta.h"
+#include "Output.h"
+#include "Bed.h"
+
+bool BedReader::Open(const std::string& filename)
+{
+	filename_ = filename;
+	file_.open(filename, std::ios::in);
+	if (!file_.is_open()) {
+		std::cerr << "Error: Can not open file '" << filename << "'!" << std::endl;
+		failed_ = true;
+		return false;
+	}
+	return true;
+}
+
+bool BedReader::Next(BedRegion& region)
+{
+	if (failed_) {
+		return false;
+	}
+	while (std::getline(file_, line_)) {
+		++lineNo_;
+		if (line_.empty() || line_[0] == '#') continue;
+
+		sp_.Split(line_, '\t');
+		StringRef chrom = sp_.GetField(0);
+		region.chrom_.assign(chrom.Data(), chrom.Size());
+		if (!ParseInt(sp_.GetField(1), region.start_) || !ParseInt(sp_.GetField(2), region.end_)) {
+			std::cerr << "Unexpected error in line " << lineNo_ << " of file '" << filename_ << "'! Invalid region" << std::endl;
+			failed_ = true;
+			return false;
+		}
+		return true;
+	}
+	return false;
+}
+
+size_t BedReader::Read(std::vector<BedPart>& parts, size_t maxCount, long long maxBases, long long partSize, const Fasta& fa)
+{
+	size_t count = 0;
+	long long bases = 0;
+	BedRegion region;
+	BedPart part;
+	while (count < maxCount && bases < maxBases) {
+		if (!splitter_.Next(part)) {
+			if (!Next(region)) {
+				break;
+			}
+			int id = fa.GetId(region.chrom_);
+			splitter_.Reset(region, partSize, id < 0 ? 0 : fa.GetLength(id));
+			continue;
+		}
+		bases += part.end_ - part.start_;
+		parts.push_back(part);
+		++count;
+	}
+	return count;
+}
+
+void RegionSplitter::Reset(const BedRegion& region, long long size, long long length)
+{
+	part_.region_ = region;
+	part_.start_ = (region.start_ < 0 ? 0 : region.start_);
+	part_.first_ = true;
+	size_ = size;
+	end_ = std::max(part_.start_, std::min(region.end_, length));
+	done_ = false;
+}
+
+bool RegionSplitter::Next(BedPart& part)
+{
+	if (done_) {
+		return false;
+	}
+	part_.end_ = (end_ - part_.start_ > size_ ? part_.start_ + size_ : end_);
+	part_.last_ = (part_.end_ >= end_);
+	part = part_;
+	part_.start_ = part_.end_;
+	part_.first_ = false;
+	done_ = part.last_;
+	return true;
+}
+
+bool LoadBed(const std::string& filename, std::vector<BedRegion>& regions)
+{
+	BedReader bed;
+	if (!bed.Open(filename)) {
+		return false;
+	}
+	BedRegion region;
+	while (bed.Next(region)) {
+		regions.push_back(region);
+	}
+	return !bed.Failed();
+}
+
+int CheckRegion(const Fasta& fa, const std::string& chrom, long long& start, long long end, Output* messages)
+{
+	if (start < 0) {
+		start = 0;
+	}
+	if (start >= end) {
+		if (messages) {
+			*messages << "Skip invalid region: " << chrom << ":" << start + 1 << "-" << end << '\n';
+		}
+		return -1;
+	}
+	int id = fa.GetId(chrom);
+	size_t len = (id < 0 ? 0 : fa.GetLength(id));
+	if (len == 0) {
+		if (messages) {
+			*messages << "Skip non-existed sequence: '" << chrom << "'!" << '\n';
+		}
+		return -1;
+	}
+	if (start >= static_cast<long long>(len)) {
+		if (messages) {
+			*messages << "Skip non-existed region: " << chrom << ":" << start + 1 << "-" << end << '\n';
+		}
+		return -1;
+	}
+	return id;
+}
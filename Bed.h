@@ -0,0 +1,79 @@
+#ifndef __BED_H__
+#define __BED_H__
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include "LineSplit.h"
+
+class Fasta;
+class Output;
+
+struct BedRegion
+{
+	std::string chrom_;
+	long long start_; // 0-based
+	long long end_;   // exclusive
+};
+
+// Part of a region. Regions longer than a batch are cut into consecutive
+// parts, which go to consecutive batches.
+struct BedPart
+{
+	BedRegion region_; // the whole region
+	long long start_;  // of this part
+	long long end_;
+	bool first_;
+	bool last_;
+};
+
+// Cuts a region into parts of size bases each, the last one may be shorter,
+// one at a time. Parts stop at length (of the region's sequence) if the region
+// runs past it, and a negative start is taken as 0; a region that is empty or
+// starts past length is a single part.
+class RegionSplitter
+{
+public:
+	RegionSplitter(): size_(0), end_(0), done_(true) { }
+
+	void Reset(const BedRegion& region, long long size, long long length);
+	// false once all parts are taken
+	bool Next(BedPart& part);
+private:
+	BedPart part_; // the next one
+	long long size_;
+	long long end_;
+	bool done_;
+};
+
+// Reads regions from a BED file one by one, skipping empty and '#' lines.
+// A malformed line is reported with its line number and ends the reading.
+class BedReader
+{
+public:
+	BedReader(): lineNo_(0), failed_(false) { }
+
+	bool Open(const std::string& filename);
+	bool Next(BedRegion& region);
+	// append parts of regions until maxCount of them or maxBases in total,
+	// for batches; regions are cut into parts of partSize bases, up to the
+	// end of their sequence in fa
+	size_t Read(std::vector<BedPart>& parts, size_t maxCount, long long maxBases, long long partSize, const Fasta& fa);
+	bool Failed() const { return failed_; }
+private:
+	std::string filename_;
+	std::ifstream file_;
+	std::string line_;
+	LineSplit sp_;
+	RegionSplitter splitter_; // of the last region
+	size_t lineNo_;
+	bool failed_;
+};
+
+bool LoadBed(const std::string& filename, std::vector<BedRegion>& regions);
+
+// id of the region's sequence in fa, or -1 (with a message unless messages is
+// NULL) if it should be skipped; a negative start is set to 0
+int CheckRegion(const Fasta& fa, const std::string& chrom, long long& start, long long end, Output* messages);
+
+#endif
@@ -0,0 +1,204 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Fasta.h"
+#include "CompositionIndex.h"
+
+// Layout of the index file, in host byte order:
+//   IndexHeader | IndexEntry x count | names | padding | samples
+// Each sequence has length / step + 1 samples of 5 counters, the counts of
+// A, C, G, T and N before position i * step. A packed reference reads IUPAC
+// codes back as N, so the header records whether the counts were taken from
+// one, and an index is only used with a reference loaded the same way.
+static const char INDEX_MAGIC[8] = { 'C', 'R', 'A', 'B', 'C', 'I', 'D', 'X' };
+static const uint32_t INDEX_VERSION = 2;
+static const size_t COUNTERS = 5;
+
+struct IndexHeader
+{
+	char magic_[8];
+	uint32_t version_;
+	uint32_t step_;
+	uint32_t packed_; // counted from a packed reference
+	uint32_t reserved_;
+	uint64_t count_;
+	uint64_t namesOffset_;
+	uint64_t samplesOffset_;
+};
+
+struct IndexEntry
+{
+	uint64_t nameOffset_;
+	uint64_t nameLength_;
+	uint64_t length_;
+	uint64_t first_;
+};
+
+static size_t GetSampleCount(size_t length, uint32_t step)
+{
+	return length / step + 1;
+}
+
+bool CompositionIndex::Load(const std::string& filename, const Fasta& fa)
+{
+	struct stat st, st2;
+	if (stat(filename.c_str(), &st) != 0) {
+		return false;
+	}
+	if (stat(filename.substr(0, filename.size() - 5).c_str(), &st2) == 0 && st.st_mtime < st2.st_mtime) {
+		return false; // index is older than the reference, rebuild it
+	}
+	if (!file_.Open(filename)) {
+		return false;
+	}
+
+	const char* data = file_.Data();
+	size_t size = file_.Size();
+	const IndexHeader* header = reinterpret_cast<const IndexHeader*>(data);
+	bool valid = (size >= sizeof(IndexHeader) && memcmp(header->magic_, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0
+		&& header->version_ == INDEX_VERSION && header->step_ > 0 && header->count_ == fa.GetCount()
+		&& header->packed_ == (fa.IsPacked() ? 1u : 0u)
+		&& header->namesOffset_ == sizeof(IndexHeader) + header->count_ * sizeof(IndexEntry)
+		&& header->samplesOffset_ >= header->namesOffset_ && header->samplesOffset_ % sizeof(uint64_t) == 0
+		&& header->samplesOffset_ <= size);
+
+	std::vector<uint64_t> first;
+	const IndexEntry* entries = reinterpret_cast<const IndexEntry*>(data + sizeof(IndexHeader));
+	uint64_t samples = 0;
+	for (size_t i = 0; valid && i < header->count_; ++i) {
+		const IndexEntry& e = entries[i];
+		const std::string& name = fa.GetName(i);
+		valid = (header->namesOffset_ + e.nameOffset_ + e.nameLength_ <= header->samplesOffset_
+			&& e.nameLength_ == name.size() && memcmp(data + header->namesOffset_ + e.nameOffset_, name.data(), name.size()) == 0
+			&& e.length_ == fa.GetLength(i) && e.first_ == samples);
+		first.push_back(e.first_);
+		samples += GetSampleCount(e.length_, header->step_);
+	}
+	if (!valid || header->samplesOffset_ + samples * COUNTERS * sizeof(uint64_t) > size) {
+		file_.Close();
+		return false;
+	}
+
+	memory_.clear();
+	first_.swap(first);
+	samples_ = reinterpret_cast<const uint64_t*>(data + header->samplesOffset_);
+	step_ = header->step_;
+	packed_ = (header->packed_ != 0);
+	return true;
+}
+
+void CompositionIndex::Scan(const Fasta& fa, size_t id, size_t pos, size_t size, std::string& buffer, BaseCounts& counts)
+{
+	if (size == 0) {
+		return;
+	}
+	fa.ForEachSegment(id, pos, size, buffer, [&](StringRef seq) {
+			CountBases(seq.Data(), seq.Size(), counts);
+		});
+}
+
+void CompositionIndex::Build(const Fasta& fa, uint32_t step)
+{
+	file_.Close();
+	memory_.clear();
+	first_.clear();
+	step_ = step;
+	packed_ = fa.IsPacked();
+
+	std::string buffer;
+	for (size_t id = 0; id < fa.GetCount(); ++id) {
+		first_.push_back(memory_.size() / COUNTERS);
+		size_t length = fa.GetLength(id);
+		BaseCounts counts;
+		for (size_t pos = 0; ; pos += step) {
+			uint64_t sample[COUNTERS] = { counts.a_, counts.c_, counts.g_, counts.t_, counts.n_ };
+			memory_.insert(memory_.end(), sample, sample + COUNTERS);
+			if (pos + step > length) {
+				break;
+			}
+			Scan(fa, id, pos, step, buffer, counts);
+		}
+	}
+	samples_ = memory_.data();
+}
+
+bool CompositionIndex::Save(const std::string& filename, const Fasta& fa) const
+{
+	std::string tempFile = filename + ".tmp";
+	std::ofstream file(tempFile, std::ios::out | std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "Error: Can not open file '" << tempFile << "'!" << std::endl;
+		return false;
+	}
+
+	std::string names;
+	std::vector<IndexEntry> entries(fa.GetCount());
+	uint64_t samples = 0;
+	for (size_t i = 0; i < entries.size(); ++i) {
+		entries[i].nameOffset_ = names.size();
+		entries[i].nameLength_ = fa.GetName(i).size();
+		entries[i].length_ = fa.GetLength(i);
+		entries[i].first_ = first_[i];
+		names += fa.GetName(i);
+		samples += GetSampleCount(entries[i].length_, step_);
+	}
+
+	IndexHeader header;
+	memcpy(header.magic_, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+	header.version_ = INDEX_VERSION;
+	header.step_ = step_;
+	header.packed_ = (packed_ ? 1 : 0);
+	header.reserved_ = 0;
+	header.count_ = entries.size();
+	header.namesOffset_ = sizeof(IndexHeader) + entries.size() * sizeof(IndexEntry);
+	header.samplesOffset_ = (header.namesOffset_ + names.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(IndexEntry));
+	file << names << std::string(header.samplesOffset_ - header.namesOffset_ - names.size(), '\0');
+	file.write(reinterpret_cast<const char*>(samples_), samples * COUNTERS * sizeof(uint64_t));
+	file.close();
+	if (file.fail()) {
+		std::cerr << "Error: Failed to write file '" << tempFile << "'!" << std::endl;
+		unlink(tempFile.c_str());
+		return false;
+	}
+	if (rename(tempFile.c_str(), filename.c_str()) != 0) {
+		std::cerr << "Error: Can not rename '" << tempFile << "' to '" << filename << "'!" << std::endl;
+		unlink(tempFile.c_str());
+		return false;
+	}
+	return true;
+}
+
+size_t CompositionIndex::Count(const Fasta& fa, size_t id, size_t pos, size_t size, std::string& buffer, BaseCounts& counts) const
+{
+	if (id >= fa.GetCount() || pos >= fa.GetLength(id)) {
+		return 0;
+	}
+	if (size > fa.GetLength(id) - pos) {
+		size = fa.GetLength(id) - pos;
+	}
+	size_t end = pos + size;
+	size_t lo = (pos + step_ - 1) / step_;
+	size_t hi = end / step_;
+	if (lo >= hi) { // no whole step inside
+		Scan(fa, id, pos, size, buffer, counts);
+		return size;
+	}
+
+	const uint64_t* a = samples_ + (first_[id] + lo) * COUNTERS;
+	const uint64_t* b = samples_ + (first_[id] + hi) * COUNTERS;
+	counts.a_ += b[0] - a[0];
+	counts.c_ += b[1] - a[1];
+	counts.g_ += b[2] - a[2];
+	counts.t_ += b[3] - a[3];
+	counts.n_ += b[4] - a[4];
+	Scan(fa, id, pos, lo * step_ - pos, buffer, counts);
+	Scan(fa, id, hi * step_, end - hi * step_, buffer, counts);
+	return size;
+}
@@ -0,0 +1,48 @@
+#ifndef __COMPOSITION_INDEX_H__
+#define __COMPOSITION_INDEX_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "MappedFile.h"
+#include "BaseCount.h"
+
+class Fasta;
+
+// Cumulative A/C/G/T/N counts of a reference sampled every STEP bases, so the
+// composition of a range costs two lookups plus a scan of less than STEP
+// bases at each end. It is saved next to the reference ('<ref.fa>.cidx') and
+// mapped on load; an index older than the reference, with other sequence
+// names or lengths, or built from a reference packed differently (see
+// Fasta::IsPacked), is not loaded.
+class CompositionIndex
+{
+public:
+	static const uint32_t DEFAULT_STEP = 4096;
+
+	CompositionIndex(): samples_(NULL), step_(0), packed_(false) { }
+
+	bool Load(const std::string& filename, const Fasta& fa);
+	void Build(const Fasta& fa, uint32_t step = DEFAULT_STEP);
+	bool Save(const std::string& filename, const Fasta& fa) const;
+
+	bool IsLoaded() const { return samples_ != NULL; }
+
+	// add the counts of a range, same positions as Fasta::ForEachSegment();
+	// returns the number of bases in the range
+	size_t Count(const Fasta& fa, size_t id, size_t pos, size_t size, std::string& buffer, BaseCounts& counts) const;
+private:
+	CompositionIndex(const CompositionIndex&);
+	CompositionIndex& operator=(const CompositionIndex&);
+
+	static void Scan(const Fasta& fa, size_t id, size_t pos, size_t size, std::string& buffer, BaseCounts& counts);
+private:
+	MappedFile file_;
+	std::vector<uint64_t> memory_; // samples when built rather than mapped
+	const uint64_t* samples_; // A, C, G, T, N before each sampled position
+	std::vector<uint64_t> first_; // first sample of each sequence
+	uint32_t step_;
+	bool packed_; // counted from a packed reference, IUPAC codes as N
+};
+
+#endif
@@ -1,59 +1,564 @@
 #include <iostream>
 #include <fstream>
+#include <vector>
 #include <map>
+#include <set>
+#include <memory>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include "String.h"
 #include "LineSplit.h"
+#include "MappedFile.h"
+#include "Pipeline.h"
+#include "Histogram.h"
+#include "Output.h"
+#include "Bed.h"
 #include "DepthStat.h"
 
-static bool Process(const std::string& filename)
+const size_t CHUNK_SIZE = 16 << 20;
+
+// depths of each sample in a target region, kept until the input has passed
+// the region so that the median can be taken after chunks are merged
+typedef std::vector<Histogram> SampleCounts; // one per sample
+
+// statistics of a target region in a sample, what is left once it is passed
+struct RegionSummary
+{
+	double mean_;
+	double median_;
+	double frac_; // of bases at or above the depth threshold
+};
+
+struct Targets
 {
-	std::ifstream file(filename, std::ios::in);
-	if (!file.is_open()) {
-		std::cerr << "Error: Can not open file '" << filename << "'!" << std::endl;
+	std::vector<BedRegion> regions_; // in BED order
+	std::map<std::string, std::vector<size_t>> chroms_; // region ids, sorted by start
+};
+
+// newline-aligned part of the input, parsed independently
+struct Chunk
+{
+	Chunk(): begin_(NULL), end_(NULL), maxDepth_(LLONG_MAX), firstPos_(0), lastPos_(0), lines_(0), failedLine_(0), error_(NULL) { }
+
+	const char* begin_;
+	const char* end_;
+	std::string data_; // owns the text when input is not mapped
+	long long maxDepth_;
+	std::vector<Histogram> depthStats_; // one per sample
+	std::map<size_t, SampleCounts> regionStat_; // by region id
+	std::vector<std::pair<std::string, size_t>> chroms_; // in input order and their first line, with targets
+	long long firstPos_; // 0-based, with targets
+	long long lastPos_;
+	size_t lines_;
+	size_t failedLine_; // line in chunk (from 1) that can not be parsed
+	const char* error_;
+};
+
+// Sweep over the pileup positions of a chunk, keeping the target regions that
+// cover the current position. The input must be sorted by position, with each
+// chromosome in one run, so that regions are done once the input passes them.
+class RegionSweep
+{
+public:
+	explicit RegionSweep(const Targets& targets): targets_(targets), ids_(NULL), next_(0), last_(-1) { }
+
+	// false if the input is not sorted
+	bool Add(StringRef chrom, long long pos, const std::vector<long long>& depths, Chunk& chunk)
+	{
+		if (chunk.chroms_.empty() || chrom != StringRef(chunk.chroms_.back().first)) {
+			std::string name(chrom.Data(), chrom.Size());
+			if (!seen_.insert(name).second) {
+				return false;
+			}
+			auto it = targets_.chroms_.find(name);
+			ids_ = (it == targets_.chroms_.end() ? NULL : &it->second);
+			next_ = 0;
+			active_.clear();
+			if (chunk.chroms_.empty()) {
+				chunk.firstPos_ = pos;
+			}
+			chunk.chroms_.push_back(std::make_pair(name, chunk.lines_));
+		} else if (pos < last_) {
+			return false;
+		}
+		last_ = chunk.lastPos_ = pos;
+		if (!ids_) {
+			return true;
+		}
+
+		size_t n = 0;
+		for (size_t i = 0; i < active_.size(); ++i) {
+			if (targets_.regions_[active_[i].first].end_ > pos) {
+				active_[n++] = active_[i];
+			}
+		}
+		active_.resize(n);
+		for (; next_ < ids_->size() && targets_.regions_[(*ids_)[next_]].start_ <= pos; ++next_) {
+			size_t id = (*ids_)[next_];
+			if (targets_.regions_[id].end_ > pos) {
+				SampleCounts& counts = chunk.regionStat_[id];
+				counts.resize(depths.size(), Histogram());
+				active_.push_back(std::make_pair(id, &counts));
+			}
+		}
+
+		for (size_t i = 0; i < active_.size(); ++i) {
+			SampleCounts& counts = *active_[i].second;
+			for (size_t j = 0; j < depths.size(); ++j) {
+				counts[j].Add(depths[j]);
+			}
+		}
+		return true;
+	}
+private:
+	const Targets& targets_;
+	std::set<std::string> seen_; // chromosomes
+	const std::vector<size_t>* ids_;
+	size_t next_;
+	long long last_;
+	std::vector<std::pair<size_t, SampleCounts*>> active_;
+};
+
+static void ParseChunk(Chunk& chunk, const Targets* targets)
+{
+	LineSplit sp;
+	std::vector<long long> depths;
+	std::unique_ptr<RegionSweep> sweep(targets ? new RegionSweep(*targets) : NULL);
+	for (const char* p = chunk.begin_; p < chunk.end_; ) {
+		const char* eol = static_cast<const char*>(memchr(p, '\n', chunk.end_ - p));
+		if (!eol) {
+			eol = chunk.end_;
+		}
+		++chunk.lines_;
+
+		// chrom, pos, ref, then depth, bases and qualities of each sample
+		sp.Split(StringRef(p, eol - p), '\t');
+		size_t samples = (sp.GetCount() < 4 ? 1 : (sp.GetCount() - 1) / 3);
+		if (chunk.depthStats_.empty()) {
+			chunk.depthStats_.resize(samples, Histogram(chunk.maxDepth_));
+		} else if (samples != chunk.depthStats_.size()) {
+			chunk.failedLine_ = chunk.lines_;
+			chunk.error_ = "Inconsistent number of samples";
+			return;
+		}
+
+		depths.resize(samples);
+		for (size_t i = 0; i < samples; ++i) {
+			if (!ParseInt(sp.GetField(3 + 3 * i), depths[i]) || depths[i] < 0) {
+				chunk.failedLine_ = chunk.lines_;
+				chunk.error_ = "Invalid depth";
+				return;
+			}
+			chunk.depthStats_[i].Add(depths[i]);
+		}
+
+		if (sweep) {
+			long long pos;
+			if (!ParseInt(sp.GetField(1), pos)) {
+				chunk.failedLine_ = chunk.lines_;
+				chunk.error_ = "Invalid position";
+				return;
+			}
+			if (!sweep->Add(sp.GetField(0), pos - 1, depths, chunk)) {
+				chunk.failedLine_ = chunk.lines_;
+				chunk.error_ = "Input is not sorted by position";
+				return;
+			}
+		}
+
+		p = eol + 1;
+	}
+}
+
+static bool LoadTargets(const std::string& filename, Targets& targets)
+{
+	std::vector<BedRegion> regions;
+	if (!LoadBed(filename, regions)) {
 		return false;
 	}
+	for (size_t i = 0; i < regions.size(); ++i) {
+		BedRegion& region = regions[i];
+		if (region.start_ < 0) {
+			region.start_ = 0;
+		}
+		if (region.start_ >= region.end_) {
+			std::cerr << "Skip invalid region: " << region.chrom_ << ":" << region.start_ + 1 << "-" << region.end_ << std::endl;
+			continue;
+		}
+		targets.chroms_[region.chrom_].push_back(targets.regions_.size());
+		targets.regions_.push_back(region);
+	}
+	for (auto it = targets.chroms_.begin(); it != targets.chroms_.end(); ++it) {
+		std::vector<size_t>& ids = it->second;
+		std::stable_sort(ids.begin(), ids.end(), [&](size_t a, size_t b) {
+				return targets.regions_[a].start_ < targets.regions_[b].start_;
+			});
+	}
+	return true;
+}
+
+// column name suffix of a sample, only used with more than one sample
+static std::string SampleSuffix(size_t sample, size_t samples)
+{
+	return (samples > 1 ? "_" + std::to_string(sample + 1) : std::string());
+}
+
+// depth at the given rank (from 0) of a region, counting positions missed by
+// the pileup as depth 0
+static long long GetDepthAt(const Histogram& counts, uint64_t zeros, uint64_t rank)
+{
+	if (rank < zeros) {
+		return 0;
+	}
+	rank -= zeros;
+	long long depth = 0;
+	bool found = false;
+	counts.ForEach([&](long long value, uint64_t count) {
+			if (found) {
+				return;
+			}
+			if (rank < count) {
+				depth = value;
+				found = true;
+			} else {
+				rank -= count;
+			}
+		});
+	return depth;
+}
+
+// statistics of a region in each sample, the histograms may be released then
+static void SummarizeRegion(const BedRegion& region, const SampleCounts& regionCounts, long long minDepth,
+	RegionSummary* summaries, size_t samples)
+{
+	uint64_t size = region.end_ - region.start_;
+	for (size_t j = 0; j < samples; ++j) {
+		static const Histogram empty;
+		const Histogram& counts = (j < regionCounts.size() ? regionCounts[j] : empty);
+		uint64_t covered = 0, above = 0;
+		counts.ForEach([&](long long depth, uint64_t count) {
+				covered += count;
+				if (depth >= minDepth) {
+					above += count;
+				}
+			});
+		double sum = counts.GetSum();
+		uint64_t zeros = (covered < size ? size - covered : 0);
+		uint64_t total = zeros + covered;
+		if (minDepth <= 0) { // positions missed by the pileup count as depth 0
+			above += zeros;
+		}
+		RegionSummary& summary = summaries[j];
+		summary.mean_ = sum / total;
+		summary.median_ = (GetDepthAt(counts, zeros, (total - 1) / 2) + GetDepthAt(counts, zeros, total / 2)) / 2.0;
+		summary.frac_ = static_cast<double>(above) / total;
+	}
+}
 
-	std::map<int, int> depthStat;
+static void OutputRegions(const Targets& targets, const std::vector<RegionSummary>& summaries, size_t samples,
+	long long minDepth, Output& out)
+{
+	out << "chrom\tstart\tend\tsize";
+	for (size_t j = 0; j < samples; ++j) {
+		out << "\tmean" << SampleSuffix(j, samples) << "\tmedian" << SampleSuffix(j, samples)
+			<< "\tfrac_ge_" << minDepth << 'x' << SampleSuffix(j, samples);
+	}
+	out << '\n';
 
-	std::string line;
-	int lineNo = 0;
-	long long totalBases = 0;
-	while (std::getline(file, line)) {
-		++lineNo;
+	for (size_t i = 0; i < targets.regions_.size(); ++i) {
+		const BedRegion& region = targets.regions_[i];
+		out << region.chrom_ << '\t' << region.start_ << '\t' << region.end_ << '\t' << region.end_ - region.start_;
+		for (size_t j = 0; j < samples; ++j) {
+			const RegionSummary& summary = summaries[i * samples + j];
+			out << '\t' << summary.mean_ << '\t' << summary.median_ << '\t' << summary.frac_;
+		}
+		out << '\n';
+	}
+}
 
-		LineSplit sp;
-		sp.Split(line, '\t', 5);
+// histogram rows for the depths seen in any sample
+static void OutputHistograms(const std::vector<Histogram>& depthStats, long long maxDepth, Output& out)
+{
+	size_t samples = depthStats.size();
+	out << "depth";
+	for (size_t j = 0; j < samples; ++j) {
+		out << "\tcount" << SampleSuffix(j, samples) << "\tratio" << SampleSuffix(j, samples);
+	}
+	out << '\n';
 
-		try {
-			int depth = stoi(sp.GetField(3));
-			++depthStat[depth];
-			totalBases += depth;
+	std::vector<long long> values;
+	for (size_t j = 0; j < samples; ++j) {
+		depthStats[j].ForEach([&](long long depth, uint64_t) {
+				values.push_back(depth);
+			});
+	}
+	std::sort(values.begin(), values.end());
+	values.erase(std::unique(values.begin(), values.end()), values.end());
 
-		} catch (const std::exception& e) {
-			std::cerr << "Unexpected error in line " << lineNo << " of file '" << filename << "'! " << e.what() << std::endl;
-			file.close();
+	std::vector<long long> bases(samples, 0);
+	for (size_t i = 0; i < values.size(); ++i) {
+		long long depth = values[i];
+		out << depth;
+		if (depth == maxDepth) { // capped values, keep their real depth
+			out << '+';
+		}
+		for (size_t j = 0; j < samples; ++j) {
+			uint64_t count = depthStats[j].Get(depth);
+			long long totalBases = depthStats[j].GetSum();
+			if (depth == maxDepth) {
+				bases[j] = totalBases;
+				out << '\t' << count << '\t' << 1.0;
+				continue;
+			}
+			bases[j] += depth * static_cast<long long>(count);
+			double ratio = static_cast<double>(bases[j]) / totalBases;
+			out << '\t' << count << '\t' << ratio;
+		}
+		out << '\n';
+	}
+}
+
+static bool Process(const std::string& filename, int threads, long long maxDepth,
+	const Targets* targets, long long minDepth, const std::string& regionFile)
+{
+	MappedFile mapped;
+	std::ifstream file;
+	if (!mapped.Open(filename, true)) {
+		file.open(filename, std::ios::in | std::ios::binary);
+		if (!file.is_open()) {
+			std::cerr << "Error: Can not open file '" << filename << "'!" << std::endl;
 			return false;
 		}
 	}
-	file.close();
 
-	std::cout << "depth\tcount\tratio" << std::endl;
-	long long bases = 0;
-	for (auto it = depthStat.begin(); it != depthStat.end(); ++it) {
-		bases += static_cast<long long>(it->first) * it->second;
-		double ratio = static_cast<double>(bases) / totalBases;
-		std::cout << it->first << '\t' << it->second << '\t' << ratio << std::endl;
+	size_t offset = 0;
+	std::string rest; // partial line left by the previous block
+	auto read = [&](Chunk& chunk) {
+		chunk.maxDepth_ = maxDepth;
+		if (mapped.IsOpen()) {
+			if (offset >= mapped.Size()) {
+				return false;
+			}
+			size_t end = offset + CHUNK_SIZE;
+			if (end < mapped.Size()) {
+				const char* eol = static_cast<const char*>(memchr(mapped.Data() + end, '\n', mapped.Size() - end));
+				end = (eol ? eol - mapped.Data() + 1 : mapped.Size());
+			} else {
+				end = mapped.Size();
+			}
+			chunk.begin_ = mapped.Data() + offset;
+			chunk.end_ = mapped.Data() + end;
+			offset = end;
+		} else {
+			chunk.data_.swap(rest);
+			size_t size = chunk.data_.size();
+			chunk.data_.resize(size + CHUNK_SIZE);
+			file.read(&chunk.data_[size], CHUNK_SIZE);
+			chunk.data_.resize(size + file.gcount());
+			if (chunk.data_.empty()) {
+				return false;
+			}
+			size_t pos = chunk.data_.rfind('\n');
+			if (file && pos != std::string::npos) {
+				rest.assign(chunk.data_, pos + 1, std::string::npos);
+				chunk.data_.resize(pos + 1);
+			}
+			chunk.begin_ = chunk.data_.data();
+			chunk.end_ = chunk.begin_ + chunk.data_.size();
+		}
+		return true;
+	};
+
+	std::vector<Histogram> depthStats;
+	std::map<size_t, SampleCounts> regionStat; // regions the input has not passed yet
+	std::vector<RegionSummary> summaries; // by region, then sample
+	std::set<std::string> passedChroms;
+	std::string lastChrom;
+	long long lastPos = 0;
+	size_t lineNo = 0;
+	auto summarize = [&](size_t id, const SampleCounts& counts) {
+		SummarizeRegion(targets->regions_[id], counts, minDepth, &summaries[id * depthStats.size()], depthStats.size());
+	};
+	// regions the input never reaches are left as not covered
+	auto initSummaries = [&]() {
+		summaries.resize(targets->regions_.size() * depthStats.size());
+		for (size_t i = 0; i < targets->regions_.size(); ++i) {
+			summarize(i, SampleCounts());
+		}
+	};
+	auto write = [&](Chunk& chunk) {
+		if (chunk.failedLine_ > 0) {
+			std::cerr << "Unexpected error in line " << lineNo + chunk.failedLine_ << " of file '" << filename << "'! " << chunk.error_ << std::endl;
+			return false;
+		}
+		if (depthStats.empty()) {
+			depthStats.resize(chunk.depthStats_.size(), Histogram(maxDepth));
+			if (targets) {
+				initSummaries();
+			}
+		} else if (depthStats.size() != chunk.depthStats_.size()) {
+			std::cerr << "Unexpected error in line " << lineNo + 1 << " of file '" << filename << "'! Inconsistent number of samples" << std::endl;
+			return false;
+		}
+		for (size_t j = 0; j < depthStats.size(); ++j) {
+			depthStats[j].Merge(chunk.depthStats_[j]);
+		}
+		if (!targets) {
+			lineNo += chunk.lines_;
+			return true;
+		}
+
+		// the chunks must continue each other in order too
+		for (size_t i = 0; i < chunk.chroms_.size(); ++i) {
+			const std::string& chrom = chunk.chroms_[i].first;
+			bool sorted = (chrom == lastChrom ? chunk.firstPos_ >= lastPos : passedChroms.count(chrom) == 0);
+			if (!sorted) {
+				std::cerr << "Unexpected error in line " << lineNo + chunk.chroms_[i].second << " of file '" << filename << "'! Input is not sorted by position" << std::endl;
+				return false;
+			}
+			if (chrom != lastChrom) {
+				if (!lastChrom.empty()) {
+					passedChroms.insert(lastChrom);
+				}
+				lastChrom = chrom;
+			}
+		}
+		if (!chunk.chroms_.empty()) {
+			lastPos = chunk.lastPos_;
+		}
+		for (auto it = chunk.regionStat_.begin(); it != chunk.regionStat_.end(); ++it) {
+			SampleCounts& counts = regionStat[it->first];
+			counts.resize(depthStats.size(), Histogram());
+			for (size_t j = 0; j < it->second.size(); ++j) {
+				counts[j].Merge(it->second[j]);
+			}
+		}
+		// keep only the regions that later chunks may still add to
+		for (auto it = regionStat.begin(); it != regionStat.end(); ) {
+			const BedRegion& region = targets->regions_[it->first];
+			if (region.chrom_ == lastChrom && region.end_ > lastPos + 1) {
+				++it;
+			} else {
+				summarize(it->first, it->second);
+				it = regionStat.erase(it);
+			}
+		}
+		lineNo += chunk.lines_;
+		return true;
+	};
+
+	auto work = [&](Chunk& chunk) {
+		ParseChunk(chunk, targets);
+	};
+	if (!RunPipeline<Chunk>(threads, read, work, write)) {
+		return false;
+	}
+
+	if (depthStats.empty()) { // empty input
+		depthStats.resize(1, Histogram(maxDepth));
+		if (targets) {
+			initSummaries();
+		}
+	}
+	if (targets) {
+		for (auto it = regionStat.begin(); it != regionStat.end(); ++it) {
+			summarize(it->first, it->second);
+		}
+		regionStat.clear();
+	}
+	Output out(STDOUT_FILENO);
+	OutputHistograms(depthStats, maxDepth, out);
+
+	if (targets) {
+		if (regionFile.empty()) {
+			out << '\n';
+			OutputRegions(*targets, summaries, depthStats.size(), minDepth, out);
+		} else {
+			int fd = open(regionFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (fd < 0) {
+				std::cerr << "Error: Can not open file '" << regionFile << "'!" << std::endl;
+				return false;
+			}
+			{
+				Output regionOut(fd);
+				OutputRegions(*targets, summaries, depthStats.size(), minDepth, regionOut);
+			}
+			close(fd);
+		}
 	}
 	return true;
 }
 
+static void PrintUsage()
+{
+	std::cout << "\n"
+		"Usage:  crabber depth-stat [options] <x.mpileup>\n"
+		"\n"
+		"Input:\n"
+		"   <x.mpileup>     samtools mpileup output of one or more samples; with more\n"
+		"                   than one, columns are written for each sample in order\n"
+		"\n"
+		"Options:\n"
+		"   -t <N>          number of threads, default: 1\n"
+		"   --max-depth <N> count depths of N and above together as 'N+'\n"
+		"   -b <BED>        also report mean and median depth of each target region,\n"
+		"                   and its fraction covered at the threshold set by -c\n"
+		"                   (the pileup must be sorted by position, as samtools writes it)\n"
+		"   -c <N>          depth threshold for the covered fraction, default: 20\n"
+		"   -o <FILE>       write the region table to FILE instead of after the histogram\n"
+		<< std::endl;
+}
+
 int DepthStat_main(int argc, char* const argv[])
 {
-	if (argc < 2) {
-		std::cout << "Usage: crabber depth-stat <x.mpileup>" << std::endl;
+	int threads = 1;
+	long long maxDepth = LLONG_MAX;
+	std::string bedFile;
+	long long minDepth = 20;
+	std::string regionFile;
+
+	std::vector<std::string> args(argv, argv + argc);
+	std::vector<std::string> restArgs;
+	for (size_t i = 1; i < args.size(); ++i) {
+		if (args[i] == "-t" && i + 1 < args.size()) {
+			threads = atoi(args[++i].c_str());
+			if (threads < 1) {
+				std::cerr << "Error: Invalid thread number '" << args[i] << "'!" << std::endl;
+				return 1;
+			}
+		} else if (args[i] == "--max-depth" && i + 1 < args.size()) {
+			if (!ParseInt(args[++i], maxDepth) || maxDepth < 0) {
+				std::cerr << "Error: Invalid max depth '" << args[i] << "'!" << std::endl;
+				return 1;
+			}
+		} else if (args[i] == "-b" && i + 1 < args.size()) {
+			bedFile = args[++i];
+		} else if (args[i] == "-c" && i + 1 < args.size()) {
+			if (!ParseInt(args[++i], minDepth) || minDepth < 0) {
+				std::cerr << "Error: Invalid depth threshold '" << args[i] << "'!" << std::endl;
+				return 1;
+			}
+		} else if (args[i] == "-o" && i + 1 < args.size()) {
+			regionFile = args[++i];
+		} else {
+			restArgs.push_back(args[i]);
+		}
+	}
+	if (restArgs.size() < 1) {
+		PrintUsage();
+		return 1;
+	}
+
+	Targets targets;
+	if (!bedFile.empty() && !LoadTargets(bedFile, targets)) {
 		return 1;
 	}
 
-	if (!Process(argv[1])) {
+	if (!Process(restArgs[0], threads, maxDepth, (bedFile.empty() ? NULL : &targets), minDepth, regionFile)) {
 		return 1;
 	}
 	return 0;
@@ -1,20 +1,403 @@
 #include <iostream>
 #include <fstream>
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
 #include "String.h"
+#include "LineSplit.h"
+#include "MappedFile.h"
 #include "Fasta.h"
+#include "GeneticCode.h"
 
-bool Fasta::Load(const std::string& filename, bool verbose)
+// Layout of the packed image, in host byte order:
+//   ImageHeader | ImageEntry x count | names | padding | bases
+// Bases of all sequences are upper-cased and concatenated without newlines,
+// starting at a page-aligned offset.
+static const char IMAGE_MAGIC[8] = { 'C', 'R', 'A', 'B', 'F', 'A', 'I', 'M' };
+static const uint32_t IMAGE_VERSION = 1;
+static const size_t IMAGE_ALIGN = 4096;
+
+struct ImageHeader
 {
-	std::ifstream file(filename, std::ios::in);
+	char magic_[8];
+	uint32_t version_;
+	uint32_t count_;
+	uint64_t namesOffset_;
+	uint64_t basesOffset_;
+};
+
+struct ImageEntry
+{
+	uint64_t nameOffset_;
+	uint64_t nameLength_;
+	uint64_t offset_;
+	uint64_t length_;
+};
+
+Fasta::Fasta(): data_(NULL), size_(0), normalized_(false)
+{
+}
+
+Fasta::~Fasta()
+{
+	Unmap();
+}
+
+bool Fasta::Load(const std::string& filename, bool verbose, bool packed)
+{
+	Unmap();
+	memory_.clear();
+	seqs_.clear();
+	index_.clear();
+	packed_.clear();
+	normalized_ = false;
+
+	if (verbose) {
+		std::cerr << "Loading fasta '" << filename << "'" << std::endl;
+	}
+
+	if (Map(filename) && LoadImage()) {
+		if (verbose) {
+			std::cerr << "  using packed image" << std::endl;
+		}
+	} else if (file_.IsOpen()) {
+		std::string indexFile = filename + ".fai";
+		if (LoadIndex(indexFile)) {
+			if (verbose) {
+				std::cerr << "  using index '" << indexFile << "'" << std::endl;
+			}
+		} else if (BuildIndex()) {
+			if (verbose) {
+				std::cerr << "  building index '" << indexFile << "'" << std::endl;
+			}
+			if (!SaveIndex(indexFile) && verbose) {
+				std::cerr << "  can not write index '" << indexFile << "', continue without saving" << std::endl;
+			}
+		} else {
+			if (verbose) {
+				std::cerr << "  can not index '" << filename << "', loading into memory" << std::endl;
+			}
+			Unmap();
+			seqs_.clear();
+			index_.clear();
+		}
+	}
+
+	if (!file_.IsOpen() && !LoadMemory(filename, verbose)) {
+		return false;
+	}
+
+	if (packed) {
+		packed_.resize(seqs_.size());
+		for (size_t i = 0; i < seqs_.size(); ++i) {
+			if (verbose) {
+				std::cerr << "  packing '" << seqs_[i].name_ << "'\r" << std::flush;
+			}
+			Pack(seqs_[i], packed_[i]);
+		}
+		Unmap();
+		std::string().swap(memory_);
+	}
+
+	if (verbose) {
+		std::cerr << "Total " << seqs_.size() << " sequence(s) loaded" << std::endl;
+	}
+	return true;
+}
+
+bool Fasta::Map(const std::string& filename)
+{
+	if (!file_.Open(filename)) {
+		return false;
+	}
+	data_ = file_.Data();
+	size_ = file_.Size();
+	return true;
+}
+
+void Fasta::Unmap()
+{
+	file_.Close();
+	data_ = NULL;
+	size_ = 0;
+}
+
+void Fasta::AddSequence(const Sequence& seq)
+{
+	index_[seq.name_] = seqs_.size();
+	seqs_.push_back(seq);
+}
+
+bool Fasta::LoadImage()
+{
+	if (size_ < sizeof(ImageHeader) || memcmp(data_, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0) {
+		return false;
+	}
+	const ImageHeader* header = reinterpret_cast<const ImageHeader*>(data_);
+	if (header->version_ != IMAGE_VERSION
+			|| header->namesOffset_ != sizeof(ImageHeader) + header->count_ * sizeof(ImageEntry)
+			|| header->basesOffset_ < header->namesOffset_ || header->basesOffset_ > size_) {
+		return false;
+	}
+
+	const ImageEntry* entries = reinterpret_cast<const ImageEntry*>(data_ + sizeof(ImageHeader));
+	for (uint32_t i = 0; i < header->count_; ++i) {
+		const ImageEntry& e = entries[i];
+		if (header->namesOffset_ + e.nameOffset_ + e.nameLength_ > header->basesOffset_
+				|| e.offset_ < header->basesOffset_ || e.offset_ + e.length_ > size_) {
+			seqs_.clear();
+			index_.clear();
+			return false;
+		}
+		Sequence seq;
+		seq.name_.assign(data_ + header->namesOffset_ + e.nameOffset_, e.nameLength_);
+		seq.length_ = e.length_;
+		seq.offset_ = e.offset_;
+		seq.lineBases_ = (e.length_ == 0 ? 1 : e.length_);
+		seq.lineWidth_ = seq.lineBases_;
+		AddSequence(seq);
+	}
+	normalized_ = true;
+	return true;
+}
+
+bool Fasta::Save(const std::string& filename, bool verbose) const
+{
+	std::string tempFile = filename + ".tmp";
+	std::ofstream file(tempFile, std::ios::out | std::ios::binary);
 	if (!file.is_open()) {
-		std::cerr << "Error: Can not open file '" << filename << "'!" << std::endl;
+		std::cerr << "Error: Can not open file '" << tempFile << "'!" << std::endl;
+		return false;
+	}
+
+	std::string names;
+	std::vector<ImageEntry> entries(seqs_.size());
+	for (size_t i = 0; i < seqs_.size(); ++i) {
+		entries[i].nameOffset_ = names.size();
+		entries[i].nameLength_ = seqs_[i].name_.size();
+		names += seqs_[i].name_;
+	}
+
+	ImageHeader header;
+	memcpy(header.magic_, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+	header.version_ = IMAGE_VERSION;
+	header.count_ = seqs_.size();
+	header.namesOffset_ = sizeof(ImageHeader) + entries.size() * sizeof(ImageEntry);
+	header.basesOffset_ = (header.namesOffset_ + names.size() + IMAGE_ALIGN - 1) / IMAGE_ALIGN * IMAGE_ALIGN;
+
+	uint64_t offset = header.basesOffset_;
+	for (size_t i = 0; i < seqs_.size(); ++i) {
+		entries[i].offset_ = offset;
+		entries[i].length_ = seqs_[i].length_;
+		offset += seqs_[i].length_;
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(ImageEntry));
+	file << names << std::string(header.basesOffset_ - header.namesOffset_ - names.size(), '\0');
+
+	const size_t CHUNK_SIZE = 1 << 20;
+	std::string buffer(CHUNK_SIZE, '\0');
+	for (size_t i = 0; i < seqs_.size(); ++i) {
+		if (verbose) {
+			std::cerr << "  packing '" << seqs_[i].name_ << "'\r" << std::flush;
+		}
+		for (size_t pos = 0; pos < seqs_[i].length_; pos += CHUNK_SIZE) {
+			file.write(buffer.data(), GetSeq(i, pos, CHUNK_SIZE, &buffer[0]));
+		}
+	}
+	file.close();
+	if (file.fail()) {
+		std::cerr << "Error: Failed to write file '" << tempFile << "'!" << std::endl;
+		unlink(tempFile.c_str());
+		return false;
+	}
+	if (rename(tempFile.c_str(), filename.c_str()) != 0) {
+		std::cerr << "Error: Can not rename '" << tempFile << "' to '" << filename << "'!" << std::endl;
+		unlink(tempFile.c_str());
 		return false;
 	}
 
 	if (verbose) {
-		std::cerr << "Loading fasta '" << filename << "'" << std::endl;
+		std::cerr << "Total " << seqs_.size() << " sequence(s) packed" << std::endl;
+	}
+	return true;
+}
+
+bool Fasta::LoadIndex(const std::string& filename)
+{
+	struct stat st, st2;
+	if (stat(filename.c_str(), &st) != 0) {
+		return false;
+	}
+	if (stat(filename.substr(0, filename.size() - 4).c_str(), &st2) == 0 && st.st_mtime < st2.st_mtime) {
+		return false; // index is older than the fasta, rebuild it
 	}
 
+	std::ifstream file(filename, std::ios::in);
+	if (!file.is_open()) {
+		return false;
+	}
+
+	LineSplit sp;
+	std::string line;
+	size_t end = 0; // of the last sequence
+	while (std::getline(file, line)) {
+		if (line.empty()) continue;
+
+		if (sp.Split(line, '\t') < 5) {
+			seqs_.clear();
+			index_.clear();
+			return false;
+		}
+
+		long long values[4] = { 0, 0, 0, 0 };
+		bool valid = true;
+		for (int i = 0; i < 4; ++i) {
+			valid = valid && ParseInt(sp.GetField(i + 1), values[i]) && values[i] >= 0;
+		}
+
+		Sequence seq;
+		seq.name_ = sp.GetField(0).ToString();
+		seq.length_ = values[0];
+		seq.offset_ = values[1];
+		seq.lineBases_ = values[2];
+		seq.lineWidth_ = values[3];
+
+		valid = valid && (seq.lineBases_ > 0 && seq.lineWidth_ >= seq.lineBases_ && seq.offset_ <= size_);
+		size_t last = seq.offset_;
+		if (valid && seq.length_ > 0) {
+			last += (seq.length_ - 1) / seq.lineBases_ * seq.lineWidth_ + (seq.length_ - 1) % seq.lineBases_ + 1;
+			valid = (last <= size_);
+		}
+		if (!valid || index_.find(seq.name_) != index_.end()) {
+			seqs_.clear();
+			index_.clear();
+			return false;
+		}
+		end = std::max(end, last);
+		AddSequence(seq);
+	}
+	file.close();
+
+	// an index cut short (e.g. still being written by another process) does
+	// not reach the end of the file, only line breaks may follow the last base
+	for (; end < size_; ++end) {
+		if (data_[end] != '\n' && data_[end] != '\r') {
+			seqs_.clear();
+			index_.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Fasta::BuildIndex()
+{
+	Sequence seq;
+	bool inSeq = false;
+	bool lastLine = false;
+
+	const char* end = data_ + size_;
+	for (const char* p = data_; p < end; ) {
+		const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+		const char* next = (eol ? eol + 1 : end);
+		size_t width = next - p;
+		size_t bases = (eol ? eol : end) - p;
+		if (bases > 0 && p[bases - 1] == '\r') {
+			--bases;
+		}
+
+		if (*p == '>') {
+			if (inSeq) {
+				if (index_.find(seq.name_) != index_.end()) {
+					return false;
+				}
+				AddSequence(seq);
+			}
+			std::string name = TrimLeft(std::string(p + 1, bases - 1));
+			std::string::size_type pos = name.find_first_of(" \t");
+			seq.name_ = (pos == std::string::npos ? name : name.substr(0, pos));
+			seq.length_ = 0;
+			seq.offset_ = next - data_;
+			seq.lineBases_ = 0;
+			seq.lineWidth_ = 0;
+			inSeq = true;
+			lastLine = false;
+		} else if (bases == 0) {
+			lastLine = true; // only blank lines or a new sequence may follow
+		} else {
+			if (!inSeq || lastLine) {
+				return false;
+			}
+			if (p[0] == ' ' || p[0] == '\t' || p[bases - 1] == ' ' || p[bases - 1] == '\t') {
+				return false;
+			}
+			if (seq.lineBases_ == 0) {
+				seq.lineBases_ = bases;
+				seq.lineWidth_ = width;
+			} else if (bases > seq.lineBases_) {
+				return false;
+			}
+			if (bases < seq.lineBases_ || (next != end && width - bases != seq.lineWidth_ - seq.lineBases_)) {
+				lastLine = true;
+			}
+			seq.length_ += bases;
+		}
+		p = next;
+	}
+	if (inSeq) {
+		if (index_.find(seq.name_) != index_.end()) {
+			return false;
+		}
+		AddSequence(seq);
+	}
+	for (size_t i = 0; i < seqs_.size(); ++i) {
+		if (seqs_[i].lineBases_ == 0) { // empty sequence
+			seqs_[i].lineBases_ = 1;
+			seqs_[i].lineWidth_ = 1;
+		}
+	}
+	return true;
+}
+
+bool Fasta::SaveIndex(const std::string& filename) const
+{
+	// written aside and renamed, so concurrent jobs never read a partial index
+	std::string tempFile = filename + "." + std::to_string(getpid()) + ".tmp";
+	std::ofstream file(tempFile, std::ios::out);
+	if (!file.is_open()) {
+		return false;
+	}
+	for (size_t i = 0; i < seqs_.size(); ++i) {
+		const Sequence& seq = seqs_[i];
+		file << seq.name_ << '\t' << seq.length_ << '\t' << seq.offset_
+			<< '\t' << seq.lineBases_ << '\t' << seq.lineWidth_ << '\n';
+	}
+	file.close();
+	if (file.fail() || rename(tempFile.c_str(), filename.c_str()) != 0) {
+		unlink(tempFile.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool Fasta::LoadMemory(const std::string& filename, bool verbose)
+{
+	std::ifstream file(filename, std::ios::in);
+	if (!file.is_open()) {
+		std::cerr << "Error: Can not open file '" << filename << "'!" << std::endl;
+		return false;
+	}
+
+	std::vector<std::string> names;
+	std::map<std::string, std::string> seqs;
 	std::string chrom;
 	std::string line;
 	while (std::getline(file, line)) {
@@ -25,44 +408,172 @@ bool Fasta::Load(const std::string& filename, bool verbose)
 			if (pos != std::string::npos) {
 				chrom = chrom.substr(0, pos);
 			}
+			if (seqs.find(chrom) == seqs.end()) {
+				names.push_back(chrom);
+				seqs[chrom];
+			}
 			if (verbose) {
 				std::cerr << "  loading '" << chrom << "'\r" << std::flush;
 			}
 		} else {
-			seq_[chrom] += Trim(line);
+			if (seqs.find(chrom) == seqs.end()) {
+				names.push_back(chrom);
+			}
+			std::string s = Trim(line);
+			for (size_t i = 0; i < s.size(); ++i) {
+				s[i] = std::toupper(s[i]);
+			}
+			seqs[chrom] += s;
 		}
 	}
 	file.close();
 
-	if (verbose) {
-		std::cerr << "Total " << seq_.size() << " sequence(s) loaded" << std::endl;
+	for (size_t i = 0; i < names.size(); ++i) {
+		const std::string& s = seqs[names[i]];
+		Sequence seq;
+		seq.name_ = names[i];
+		seq.length_ = s.size();
+		seq.offset_ = memory_.size();
+		seq.lineBases_ = (s.empty() ? 1 : s.size());
+		seq.lineWidth_ = seq.lineBases_;
+		AddSequence(seq);
+		memory_ += s;
 	}
+	data_ = memory_.data();
+	size_ = memory_.size();
+	normalized_ = true;
 	return true;
 }
 
-bool Fasta::Has(const std::string& chrom) const
+// UCSC .2bit base order, the same as GetBaseCodes()
+static const char PACKED_BASES[4] = { 'T', 'C', 'A', 'G' };
+
+static void AddRun(std::vector<std::pair<size_t, size_t>>& runs, size_t pos)
+{
+	if (!runs.empty() && runs.back().second == pos) {
+		++runs.back().second;
+	} else {
+		runs.push_back(std::make_pair(pos, pos + 1));
+	}
+}
+
+void Fasta::Pack(const Sequence& seq, PackedSequence& packed) const
 {
-	return (seq_.find(chrom) != seq_.end());
+	const unsigned char* codes = GetBaseCodes();
+	packed.bases_.assign((seq.length_ + 3) / 4, 0);
+	for (size_t pos = 0; pos < seq.length_; pos += seq.lineBases_) {
+		size_t n = seq.lineBases_;
+		if (n > seq.length_ - pos) {
+			n = seq.length_ - pos;
+		}
+		const char* p = data_ + seq.offset_ + pos / seq.lineBases_ * seq.lineWidth_;
+		for (size_t i = 0; i < n; ++i) {
+			size_t k = pos + i;
+			int code = codes[static_cast<unsigned char>(p[i])];
+			if (code > 3) {
+				AddRun(packed.nRuns_, k);
+				code = 0;
+			}
+			packed.bases_[k / 4] |= code << (6 - (k % 4) * 2);
+		}
+	}
 }
 
-size_t Fasta::GetLength(const std::string& chrom) const
+size_t Fasta::UnpackSeq(const PackedSequence& packed, size_t pos, size_t size, char* buf) const
 {
-	auto it = seq_.find(chrom);
-	if (it == seq_.end()) {
+	for (size_t i = 0; i < size; ++i) {
+		size_t k = pos + i;
+		buf[i] = PACKED_BASES[(packed.bases_[k / 4] >> (6 - (k % 4) * 2)) & 3];
+	}
+
+	const Runs& runs = packed.nRuns_;
+	Runs::const_iterator it = std::upper_bound(runs.begin(), runs.end(), std::make_pair(pos, static_cast<size_t>(-1)));
+	if (it != runs.begin() && (it - 1)->second > pos) {
+		--it;
+	}
+	for (; it != runs.end() && it->first < pos + size; ++it) {
+		size_t start = std::max(it->first, pos);
+		size_t end = std::min(it->second, pos + size);
+		memset(buf + (start - pos), 'N', end - start);
+	}
+	return size;
+}
+
+size_t Fasta::CopySeq(const Sequence& seq, size_t pos, size_t size, char* buf) const
+{
+	char* q = buf;
+	while (size > 0) {
+		size_t col = pos % seq.lineBases_;
+		size_t n = seq.lineBases_ - col;
+		if (n > size) {
+			n = size;
+		}
+		const char* p = data_ + seq.offset_ + pos / seq.lineBases_ * seq.lineWidth_ + col;
+		if (normalized_) {
+			memcpy(q, p, n);
+			q += n;
+		} else {
+			for (size_t i = 0; i < n; ++i) {
+				char c = p[i];
+				*q++ = (c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c);
+			}
+		}
+		pos += n;
+		size -= n;
+	}
+	return q - buf;
+}
+
+int Fasta::GetId(const std::string& chrom) const
+{
+	auto it = index_.find(chrom);
+	if (it == index_.end()) {
+		return -1;
+	}
+	return it->second;
+}
+
+size_t Fasta::GetSeq(size_t id, size_t pos, size_t size, char* buf) const
+{
+	if (id >= seqs_.size()) {
 		return 0;
 	}
-	return it->second.size();
+	const Sequence& seq = seqs_[id];
+	if (pos >= seq.length_) {
+		return 0;
+	}
+	if (size > seq.length_ - pos) {
+		size = seq.length_ - pos;
+	}
+	if (!packed_.empty()) {
+		return UnpackSeq(packed_[id], pos, size, buf);
+	}
+	return CopySeq(seq, pos, size, buf);
 }
 
-std::string Fasta::GetSeq(const std::string& chrom, size_t pos, size_t size) const
+StringRef Fasta::GetView(size_t id, size_t pos, size_t size, std::string& buffer) const
 {
-	std::string res;
-	auto it = seq_.find(chrom);
-	if (it != seq_.end()) {
-		std::string s = it->second.substr(pos, size);
-		for (size_t i = 0; i < s.size(); ++i) {
-			res += std::toupper(s[i]);
+	if (id >= seqs_.size() || pos >= seqs_[id].length_) {
+		return StringRef();
+	}
+	const Sequence& seq = seqs_[id];
+	if (size > seq.length_ - pos) {
+		size = seq.length_ - pos;
+	}
+	if (packed_.empty() && pos % seq.lineBases_ + size <= seq.lineBases_) {
+		const char* p = data_ + seq.offset_ + pos / seq.lineBases_ * seq.lineWidth_ + pos % seq.lineBases_;
+		bool upper = normalized_;
+		if (!upper) {
+			size_t i = 0;
+			while (i < size && !std::islower(p[i])) ++i;
+			upper = (i == size);
 		}
+		if (upper) {
+			return StringRef(p, size);
+		}
+	}
+	if (buffer.size() < size) {
+		buffer.resize(size);
 	}
-	return res;
+	return StringRef(buffer.data(), GetSeq(id, pos, size, &buffer[0]));
 }
@@ -2,19 +2,125 @@
 #define __FASTA_H__
 
 #include <map>
+#include <vector>
 #include <string>
+#include <algorithm>
+#include "String.h"
+#include "MappedFile.h"
 
+// Reference genome with random access by samtools-compatible '.fai' index.
+// The FASTA file is mapped read-only, and only the bytes touched by queries
+// are paged in. FASTA files that can not be indexed (irregular line widths,
+// pipes) are loaded into memory instead.
+//
+// Load() also accepts a packed image written by Save() (see 'fasta-pack'),
+// which holds upper-cased bases without newlines behind a chromosome
+// directory. It is mapped as is, so concurrent processes share one copy in
+// the page cache and nothing is parsed at startup.
+//
+// With 'packed' set, Load() converts the reference into 2 bits per base
+// (UCSC .2bit style) plus a sorted run list of N bases, and releases the
+// source. This takes about a quarter of the memory of plain bases; non-ACGT
+// bases are read back as 'N', and lower case as upper case.
+//
+// Queries are by sequence id (see GetId), so they avoid the name lookup.
+// GetView() does not allocate: the view points into the reference when the
+// range is stored contiguous and upper-cased, or into the caller's buffer.
 class Fasta
 {
 public:
-	bool Load(const std::string& filename, bool verbose = false);
+	Fasta();
+	~Fasta();
 
-	bool Has(const std::string& chrom) const;
-	size_t GetLength(const std::string& chrom) const;
+	bool Load(const std::string& filename, bool verbose = false, bool packed = false);
+	bool Save(const std::string& filename, bool verbose = false) const;
 
-	std::string GetSeq(const std::string& chrom, size_t pos, size_t size = 1) const;
+	size_t GetCount() const { return seqs_.size(); }
+	bool IsPacked() const { return !packed_.empty(); } // 2 bits per base
+	int GetId(const std::string& chrom) const;
+	const std::string& GetName(size_t id) const { return seqs_[id].name_; }
+	size_t GetLength(size_t id) const { return seqs_[id].length_; }
+
+	size_t GetSeq(size_t id, size_t pos, size_t size, char* buf) const;
+	StringRef GetView(size_t id, size_t pos, size_t size, std::string& buffer) const;
+
+	// Call f(StringRef) on consecutive pieces of a range as stored, for scans
+	// that only count letters: a mapped FASTA is passed as one piece with its
+	// line breaks and original case, a packed one is unpacked into the buffer
+	// block by block. Returns the number of bases in the range.
+	template <typename F>
+	size_t ForEachSegment(size_t id, size_t pos, size_t size, std::string& buffer, F f) const;
+private:
+	Fasta(const Fasta&);
+	Fasta& operator=(const Fasta&);
+
+	struct Sequence
+	{
+		std::string name_;
+		size_t length_;
+		size_t offset_;
+		size_t lineBases_;
+		size_t lineWidth_;
+	};
+
+	typedef std::vector<std::pair<size_t, size_t>> Runs; // sorted [start, end)
+
+	struct PackedSequence
+	{
+		std::vector<unsigned char> bases_;
+		Runs nRuns_;
+	};
+
+	bool Map(const std::string& filename);
+	void Unmap();
+	bool LoadImage();
+	bool LoadIndex(const std::string& filename);
+	bool BuildIndex();
+	bool SaveIndex(const std::string& filename) const;
+	bool LoadMemory(const std::string& filename, bool verbose);
+	void AddSequence(const Sequence& seq);
+	void Pack(const Sequence& seq, PackedSequence& packed) const;
+	size_t CopySeq(const Sequence& seq, size_t pos, size_t size, char* buf) const;
+	size_t UnpackSeq(const PackedSequence& packed, size_t pos, size_t size, char* buf) const;
 private:
-	std::map<std::string, std::string> seq_;
+	MappedFile file_;
+	const char* data_; // mapped file or memory_
+	size_t size_;
+	bool normalized_; // bases are stored upper-cased
+	std::string memory_;
+	std::vector<Sequence> seqs_;
+	std::map<std::string, size_t> index_;
+	std::vector<PackedSequence> packed_;
 };
 
+template <typename F>
+size_t Fasta::ForEachSegment(size_t id, size_t pos, size_t size, std::string& buffer, F f) const
+{
+	if (id >= seqs_.size() || pos >= seqs_[id].length_) {
+		return 0;
+	}
+	const Sequence& seq = seqs_[id];
+	if (size > seq.length_ - pos) {
+		size = seq.length_ - pos;
+	}
+	if (packed_.empty()) {
+		size_t last = pos + size - 1;
+		const char* begin = data_ + seq.offset_ + pos / seq.lineBases_ * seq.lineWidth_ + pos % seq.lineBases_;
+		const char* end = data_ + seq.offset_ + last / seq.lineBases_ * seq.lineWidth_ + last % seq.lineBases_ + 1;
+		f(StringRef(begin, end - begin));
+		return size;
+	}
+
+	const size_t BLOCK_SIZE = 1 << 16;
+	if (buffer.size() < std::min(size, BLOCK_SIZE)) {
+		buffer.resize(std::min(size, BLOCK_SIZE));
+	}
+	for (size_t i = 0; i < size; i += BLOCK_SIZE) {
+		size_t n = std::min(size - i, BLOCK_SIZE);
+		UnpackSeq(packed_[id], pos + i, n, &buffer[0]);
+		f(StringRef(buffer.data(), n));
+	}
+	return size;
+}
+
 #endif
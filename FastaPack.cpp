@@ -0,0 +1,50 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include "Fasta.h"
+#include "FastaPack.h"
+
+static void PrintUsage()
+{
+	std::cout << "\n"
+		"Usage:  crabber fasta-pack [options] <ref.fa> <ref.img>\n"
+		"\n"
+		"Input:\n"
+		"   <ref.fa>        reference genome in FASTA format\n"
+		"\n"
+		"Output:\n"
+		"   <ref.img>       packed reference image, which could be used in place\n"
+		"                   of <ref.fa> by other commands and shared between them\n"
+		"\n"
+		"Options:\n"
+		"   -v              show progress\n"
+		<< std::endl;
+}
+
+int FastaPack_main(int argc, char* const argv[])
+{
+	bool verbose = false;
+
+	std::vector<std::string> args(argv, argv + argc);
+	std::vector<std::string> restArgs;
+	for (size_t i = 1; i < args.size(); ++i) {
+		if (args[i] == "-v") {
+			verbose = true;
+		} else {
+			restArgs.push_back(args[i]);
+		}
+	}
+	if (restArgs.size() < 2) {
+		PrintUsage();
+		return 1;
+	}
+
+	Fasta fa;
+	if (!fa.Load(restArgs[0], verbose)) {
+		return 1;
+	}
+	if (!fa.Save(restArgs[1], verbose)) {
+		return 1;
+	}
+	return 0;
+}
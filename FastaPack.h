@@ -0,0 +1,6 @@
+#ifndef __FASTA_PACK_H__
+#define __FASTA_PACK_H__
+
+int FastaPack_main(int argc, char* const argv[]);
+
+#endif
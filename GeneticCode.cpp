@@ -0,0 +1,113 @@
+#include "GeneticCode.h"
+
+// NCBI translation tables 1 and 2, codons in TCAG order
+static constexpr char STANDARD_CODE[] =
+	"FFLLSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG";
+static constexpr char VERTEBRATE_MITOCHONDRIAL_CODE[] =
+	"FFLLSSSSYY**CCWWLLLLPPPPHHQQRRRRIIMMTTTTNNKKSS**VVVVAAAADDEEGGGG";
+
+static_assert(sizeof(STANDARD_CODE) == 65, "64 codons");
+static_assert(sizeof(VERTEBRATE_MITOCHONDRIAL_CODE) == 65, "64 codons");
+
+// code of a byte, see GetBaseCodes()
+static constexpr unsigned char BaseCode(int c)
+{
+	return (c == 'T' || c == 't') ? 0 : (c == 'C' || c == 'c') ? 1 : (c == 'A' || c == 'a') ? 2 :
+		(c == 'G' || c == 'g') ? 3 : (c == 'N' || c == 'n') ? BASE_CODE_N : BASE_CODE_OTHER;
+}
+
+// complement of a byte, see ComplementBase()
+static constexpr char Complement(int c)
+{
+	return (c == 'A' || c == 'a') ? 'T' : (c == 'C' || c == 'c') ? 'G' : (c == 'G' || c == 'g') ? 'C' :
+		(c == 'T' || c == 't') ? 'A' : static_cast<char>(c);
+}
+
+// the tables are constant-initialized, so they are ready before any static constructor runs
+#define BYTE_ROW(f, i) f(i), f(i + 1), f(i + 2), f(i + 3), f(i + 4), f(i + 5), f(i + 6), f(i + 7), \
+	f(i + 8), f(i + 9), f(i + 10), f(i + 11), f(i + 12), f(i + 13), f(i + 14), f(i + 15)
+#define BYTE_TABLE(f) { BYTE_ROW(f, 0), BYTE_ROW(f, 16), BYTE_ROW(f, 32), BYTE_ROW(f, 48), \
+	BYTE_ROW(f, 64), BYTE_ROW(f, 80), BYTE_ROW(f, 96), BYTE_ROW(f, 112), \
+	BYTE_ROW(f, 128), BYTE_ROW(f, 144), BYTE_ROW(f, 160), BYTE_ROW(f, 176), \
+	BYTE_ROW(f, 192), BYTE_ROW(f, 208), BYTE_ROW(f, 224), BYTE_ROW(f, 240) }
+
+static constexpr unsigned char BASE_CODES[256] = BYTE_TABLE(BaseCode);
+static constexpr char COMPLEMENTS[256] = BYTE_TABLE(Complement);
+
+#undef BYTE_TABLE
+#undef BYTE_ROW
+
+static_assert(BASE_CODES['T'] == 0 && BASE_CODES['c'] == 1 && BASE_CODES['A'] == 2 && BASE_CODES['g'] == 3,
+		"TCAG order");
+static_assert(BASE_CODES['n'] == BASE_CODE_N && BASE_CODES['R'] == BASE_CODE_OTHER && BASE_CODES[255] == BASE_CODE_OTHER,
+		"N and other bytes");
+static_assert(COMPLEMENTS['a'] == 'T' && COMPLEMENTS['G'] == 'C' && COMPLEMENTS['N'] == 'N', "complements");
+
+const GeneticCode& GeneticCode::Standard()
+{
+	static const GeneticCode code(STANDARD_CODE);
+	return code;
+}
+
+const GeneticCode& GeneticCode::VertebrateMitochondrial()
+{
+	static const GeneticCode code(VERTEBRATE_MITOCHONDRIAL_CODE);
+	return code;
+}
+
+const GeneticCode& GeneticCode::ForChrom(const std::string& chrom)
+{
+	if (chrom == "chrM" || chrom == "chrMT" || chrom == "MT" || chrom == "M") {
+		return VertebrateMitochondrial();
+	}
+	return Standard();
+}
+
+int GeneticCode::Pack(const char* codon)
+{
+	unsigned b1 = BASE_CODES[static_cast<unsigned char>(codon[0])];
+	unsigned b2 = BASE_CODES[static_cast<unsigned char>(codon[1])];
+	unsigned b3 = BASE_CODES[static_cast<unsigned char>(codon[2])];
+	if ((b1 | b2 | b3) & 4) { // BASE_CODE_N or BASE_CODE_OTHER
+		return -1;
+	}
+	return (b1 << 4) | (b2 << 2) | b3;
+}
+
+const char* GeneticCode::GetName3(char aa)
+{
+	switch (aa) {
+	case 'A': return "Ala";
+	case 'C': return "Cys";
+	case 'D': return "Asp";
+	case 'E': return "Glu";
+	case 'F': return "Phe";
+	case 'G': return "Gly";
+	case 'H': return "His";
+	case 'I': return "Ile";
+	case 'K': return "Lys";
+	case 'L': return "Leu";
+	case 'M': return "Met";
+	case 'N': return "Asn";
+	case 'P': return "Pro";
+	case 'Q': return "Gln";
+	case 'R': return "Arg";
+	case 'S': return "Ser";
+	case 'T': return "Thr";
+	case 'V': return "Val";
+	case 'W': return "Trp";
+	case 'Y': return "Tyr";
+	case '*': return "*";
+	default: return "Xaa";
+	}
+}
+
+char ComplementBase(char base)
+{
+	return COMPLEMENTS[static_cast<unsigned char>(base)];
+}
+
+const unsigned char* GetBaseCodes()
+{
+	return BASE_CODES;
+}
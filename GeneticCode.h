@@ -0,0 +1,44 @@
+#ifndef __GENETIC_CODE_H__
+#define __GENETIC_CODE_H__
+
+#include <string>
+
+// Translation of codons by an NCBI genetic code. Codons are packed into 6
+// bits, 2 bits per base in TCAG order, which is the order of the NCBI tables.
+// Amino acids are single letters, '*' for stop and 'X' for codons with bases
+// other than ACGT (either case); nothing allocates or throws.
+class GeneticCode
+{
+public:
+	static const GeneticCode& Standard();
+	static const GeneticCode& VertebrateMitochondrial();
+
+	// the vertebrate mitochondrial code for chrM/MT, the standard one otherwise
+	static const GeneticCode& ForChrom(const std::string& chrom);
+
+	// packed codon of 3 bases, or -1 if any of them is not ACGT
+	static int Pack(const char* codon);
+
+	char Translate(int packed) const { return packed < 0 ? 'X' : aminoAcids_[packed]; }
+	char Translate(const char* codon) const { return Translate(Pack(codon)); }
+
+	// three-letter code of an amino acid ("Xaa" if unknown, '*' is kept)
+	static const char* GetName3(char aa);
+private:
+	explicit GeneticCode(const char* aminoAcids): aminoAcids_(aminoAcids) { }
+
+	const char* aminoAcids_; // by packed codon
+};
+
+// complement of a base, upper-cased; other bytes are returned as is
+char ComplementBase(char base);
+
+// Code of each byte, shared by codon packing, 2-bit packed references and
+// base counting: 0-3 for T, C, A and G (TCAG order, as in the NCBI tables and
+// UCSC .2bit), BASE_CODE_N for N and BASE_CODE_OTHER for anything else,
+// either case.
+const int BASE_CODE_N = 4;
+const int BASE_CODE_OTHER = 5;
+const unsigned char* GetBaseCodes();
+
+#endif
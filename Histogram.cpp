@@ -0,0 +1,39 @@
+#include "Histogram.h"
+
+void Histogram::Merge(const Histogram& other)
+{
+	if (dense_.size() < other.dense_.size()) {
+		dense_.resize(other.dense_.size(), 0);
+	}
+	for (size_t i = 0; i < other.dense_.size(); ++i) {
+		dense_[i] += other.dense_[i];
+	}
+	for (auto it = other.overflow_.begin(); it != other.overflow_.end(); ++it) {
+		overflow_[it->first] += it->second;
+	}
+	sum_ += other.sum_;
+}
+
+uint64_t Histogram::Get(long long value) const
+{
+	value = (value < cap_ ? value : cap_);
+	if (value < static_cast<long long>(dense_.size())) {
+		return dense_[value];
+	}
+	auto it = overflow_.find(value);
+	return (it == overflow_.end() ? 0 : it->second);
+}
+
+void Histogram::AddSlow(long long value)
+{
+	if (value >= DENSE_SIZE) {
+		++overflow_[value];
+		return;
+	}
+	size_t size = (dense_.size() < 16 ? 16 : dense_.size() * 2);
+	while (size <= static_cast<size_t>(value)) {
+		size *= 2;
+	}
+	dense_.resize(size < static_cast<size_t>(DENSE_SIZE) ? size : DENSE_SIZE, 0);
+	++dense_[value];
+}
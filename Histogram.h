@@ -0,0 +1,64 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <stdint.h>
+
+// Histogram of non-negative integers with 64-bit counters. Values below
+// DENSE_SIZE are counted in a flat array, larger ones go to a sparse overflow
+// map; values above the cap (if any) are counted at the cap. The array grows
+// by doubling to cover the largest value seen, so a histogram costs memory in
+// proportion to its values rather than to DENSE_SIZE, and adding a value is a
+// clamp and an array increment, with a single branch to the out-of-line path
+// that is only taken to grow the array or for values past it.
+class Histogram
+{
+public:
+	static const long long DENSE_SIZE = 65536;
+
+	explicit Histogram(long long cap = LLONG_MAX): sum_(0), cap_(cap) { }
+
+	void Add(long long value)
+	{
+		sum_ += value;
+		value = std::min(value, cap_);
+		if (static_cast<size_t>(value) < dense_.size()) {
+			++dense_[value];
+		} else {
+			AddSlow(value);
+		}
+	}
+
+	void Merge(const Histogram& other);
+	uint64_t Get(long long value) const;
+
+	long long GetCap() const { return cap_; }
+	long long GetSum() const { return sum_; } // of values before capping
+
+	// call f(value, count) for each value counted, in increasing order
+	template <typename F>
+	void ForEach(F f) const
+	{
+		for (size_t i = 0; i < dense_.size(); ++i) {
+			if (dense_[i] > 0) {
+				f(static_cast<long long>(i), dense_[i]);
+			}
+		}
+		for (auto it = overflow_.begin(); it != overflow_.end(); ++it) {
+			f(it->first, it->second);
+		}
+	}
+private:
+	void AddSlow(long long value);
+private:
+	std::vector<uint64_t> dense_;
+	std::map<long long, uint64_t> overflow_;
+	long long sum_;
+	long long cap_;
+};
+
+#endif
@@ -1,29 +1,31 @@
+#include <cstring>
 #include "LineSplit.h"
 
-std::string LineSplit::GetField(size_t index) const
+size_t LineSplit::Split(StringRef s, char sep, size_t maxCount)
 {
-	if (index >= 0 && index + 1 < pos_.size() && (maxCount_ == 0 || index + 1 < maxCount_)) {
-		return std::string(pos_[index], pos_[index + 1] - 1);
-	} else if (index < pos_.size()) {
-		return std::string(pos_[index]);
-	} else {
-		return "";
+	const char* p = s.Data();
+	const char* end = p + s.Size();
+	while (end > p && (end[-1] == '\n' || end[-1] == '\r')) {
+		--end;
 	}
-}
-
-size_t LineSplit::Split(const std::string& s, char sep, size_t maxCount)
-{
-	pos_.clear();
-	maxCount_ = maxCount;
 
-	pos_.push_back(s.c_str());
-	for (const char *p = s.c_str(); maxCount == 0 || pos_.size() <= maxCount; ++p) {
-		if (*p == sep) {
-			pos_.push_back(p + 1);
-		} else if (*p == '\r' || *p == '\n' || *p == '\0') {
-			pos_.push_back(p + 1);
+	count_ = 0;
+	for (;;) {
+		const char* q = end;
+		if (maxCount == 0 || count_ + 1 < maxCount) {
+			q = static_cast<const char*>(memchr(p, sep, end - p));
+			if (!q) {
+				q = end;
+			}
+		}
+		if (count_ == fields_.size()) {
+			fields_.push_back(StringRef());
+		}
+		fields_[count_++] = StringRef(p, q - p);
+		if (q == end) {
 			break;
 		}
+		p = q + 1;
 	}
-	return pos_.size() - 1;
+	return count_;
 }
@@ -3,17 +3,26 @@
 
 #include <vector>
 #include <string>
+#include "String.h"
 
+// Splits a line into fields, which are views into the line itself. The
+// field table is kept between lines, so one LineSplit reused over a file
+// does not allocate once it has grown. Separators are searched with
+// memchr(), which is vectorized by the C library. With 'maxCount', the last
+// field holds the rest of the line. A trailing '\r' or '\n' is dropped.
 class LineSplit
 {
 public:
-	LineSplit(): maxCount_(0) { }
+	LineSplit(): count_(0) { }
 public:
-	size_t Split(const std::string& s, char sep = '\t', size_t maxCount = 0);
-	std::string GetField(size_t index) const;
+	size_t Split(const std::string& s, char sep = '\t', size_t maxCount = 0) { return Split(StringRef(s), sep, maxCount); }
+	size_t Split(StringRef s, char sep = '\t', size_t maxCount = 0);
+
+	size_t GetCount() const { return count_; }
+	StringRef GetField(size_t index) const { return (index < count_ ? fields_[index] : StringRef()); }
 private:
-	std::vector<const char*> pos_;
-	size_t maxCount_;
+	std::vector<StringRef> fields_;
+	size_t count_;
 };
 
 #endif
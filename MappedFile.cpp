@@ -0,0 +1,41 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "MappedFile.h"
+
+bool MappedFile::Open(const std::string& filename, bool sequential)
+{
+	Close();
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return false;
+	}
+	if (sequential) {
+		madvise(p, st.st_size, MADV_SEQUENTIAL);
+	}
+	data_ = static_cast<const char*>(p);
+	size_ = st.st_size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data_) {
+		munmap(const_cast<char*>(data_), size_);
+		data_ = NULL;
+		size_ = 0;
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <string>
+
+// Regular file mapped read-only into memory. Open() fails on anything that
+// can not be mapped (pipes, empty files), so callers can fall back to reading.
+class MappedFile
+{
+public:
+	MappedFile(): data_(NULL), size_(0) { }
+	~MappedFile() { Close(); }
+
+	bool Open(const std::string& filename, bool sequential = false);
+	void Close();
+
+	bool IsOpen() const { return data_ != NULL; }
+	const char* Data() const { return data_; }
+	size_t Size() const { return size_; }
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+private:
+	const char* data_;
+	size_t size_;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include "Output.h"
+
+Output::Output(int fd, size_t capacity): fd_(fd), capacity_(capacity), failed_(false)
+{
+	buf_.reserve(fd_ >= 0 ? capacity_ : 0);
+}
+
+Output::~Output()
+{
+	Flush();
+}
+
+Output& Output::Write(const char* s, size_t n)
+{
+	if (fd_ >= 0 && buf_.size() + n > capacity_) {
+		Flush();
+		if (n >= capacity_) { // write through rather than copy
+			WriteAll(s, n);
+			return *this;
+		}
+	}
+	buf_.append(s, n);
+	return Check();
+}
+
+char* Output::Extend(size_t n)
+{
+	Check();
+	size_t size = buf_.size();
+	buf_.resize(size + n);
+	return &buf_[size];
+}
+
+Output& Output::operator<<(double d)
+{
+	char s[32];
+	int n = snprintf(s, sizeof(s), "%g", d);
+	return Write(s, n);
+}
+
+bool Output::Flush()
+{
+	if (fd_ < 0) {
+		return true;
+	}
+	WriteAll(buf_.data(), buf_.size());
+	buf_.clear();
+	return !failed_;
+}
+
+void Output::WriteAll(const char* p, size_t size)
+{
+	while (size > 0 && !failed_) {
+		ssize_t n = write(fd_, p, size);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			failed_ = true; // e.g. closed pipe, drop the rest of output
+			break;
+		}
+		p += n;
+		size -= n;
+	}
+}
@@ -0,0 +1,85 @@
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <string>
+#include "String.h"
+
+// Text output collected in a large user-space buffer, with hand-rolled
+// number formatting. The buffer goes to the file descriptor only when it
+// is full, on Flush() or on destruction; a write larger than the buffer
+// goes straight through. Without a file descriptor it just
+// collects text, e.g. for one batch of a pipeline.
+class Output
+{
+public:
+	explicit Output(int fd = -1, size_t capacity = 1 << 20);
+	~Output();
+
+	Output& Write(const char* s, size_t n);
+	bool Flush();
+
+	// n bytes appended at the end for the caller to fill in place, valid
+	// until the next output
+	char* Extend(size_t n);
+
+	const std::string& Str() const { return buf_; }
+	void Clear() { buf_.clear(); }
+
+	Output& operator<<(char c)
+	{
+		buf_ += c;
+		return Check();
+	}
+	Output& operator<<(const char* s) { return Write(s, strlen(s)); }
+	Output& operator<<(const std::string& s) { return Write(s.data(), s.size()); }
+	Output& operator<<(const StringRef& s) { return Write(s.Data(), s.Size()); }
+
+	Output& operator<<(int n) { return WriteInt(n); }
+	Output& operator<<(long n) { return WriteInt(n); }
+	Output& operator<<(long long n) { return WriteInt(n); }
+	Output& operator<<(unsigned int n) { return WriteUInt(n); }
+	Output& operator<<(unsigned long n) { return WriteUInt(n); }
+	Output& operator<<(unsigned long long n) { return WriteUInt(n); }
+	Output& operator<<(double d); // same as std::ostream defaults ("%g")
+private:
+	Output(const Output&);
+	Output& operator=(const Output&);
+
+	void WriteAll(const char* p, size_t size);
+
+	Output& Check()
+	{
+		if (fd_ >= 0 && buf_.size() >= capacity_) {
+			Flush();
+		}
+		return *this;
+	}
+
+	Output& WriteInt(long long n)
+	{
+		if (n < 0) {
+			buf_ += '-';
+			return WriteUInt(0ULL - static_cast<unsigned long long>(n));
+		}
+		return WriteUInt(n);
+	}
+
+	Output& WriteUInt(unsigned long long n)
+	{
+		char s[24];
+		char* p = s + sizeof(s);
+		do {
+			*--p = '0' + n % 10;
+			n /= 10;
+		} while (n > 0);
+		buf_.append(p, s + sizeof(s) - p);
+		return Check();
+	}
+private:
+	int fd_;
+	size_t capacity_;
+	bool failed_;
+	std::string buf_;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Runs batches of input through a pool of worker threads and hands them back
+// in input order (a reorder buffer of at most 2 batches per thread):
+//   read(Batch&)  fills the next batch on the calling thread, false at the end
+//   work(Batch&)  processes a batch on a worker thread
+//   write(Batch&) consumes batches on the calling thread in input order,
+//                 returns false to stop the pipeline
+// With one thread everything runs on the calling thread.
+template <typename Batch, typename Read, typename Work, typename Write>
+bool RunPipeline(int threads, Read read, Work work, Write write)
+{
+	if (threads <= 1) {
+		for (;;) {
+			Batch batch;
+			if (!read(batch)) {
+				return true;
+			}
+			work(batch);
+			if (!write(batch)) {
+				return false;
+			}
+		}
+	}
+
+	struct Slot
+	{
+		Slot(): done_(false) { }
+		Batch batch_;
+		bool done_;
+	};
+
+	std::mutex mutex;
+	std::condition_variable jobReady;
+	std::condition_variable jobDone;
+	std::deque<Slot*> jobs;
+	std::deque<std::unique_ptr<Slot>> pending; // in input order
+	bool finished = false;
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; ++i) {
+		workers.push_back(std::thread([&]() {
+				for (;;) {
+					Slot* slot;
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						jobReady.wait(lock, [&]() { return finished || !jobs.empty(); });
+						if (jobs.empty()) {
+							return;
+						}
+						slot = jobs.front();
+						jobs.pop_front();
+					}
+					work(slot->batch_);
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						slot->done_ = true;
+					}
+					jobDone.notify_all();
+				}
+			}));
+	}
+
+	bool ok = true;
+	bool eof = false;
+	while (ok) {
+		while (!eof && pending.size() < static_cast<size_t>(threads) * 2) {
+			std::unique_ptr<Slot> slot(new Slot);
+			if (!read(slot->batch_)) {
+				eof = true;
+				break;
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				jobs.push_back(slot.get());
+				pending.push_back(std::move(slot));
+			}
+			jobReady.notify_one();
+		}
+		if (pending.empty()) {
+			break;
+		}
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobDone.wait(lock, [&]() { return pending.front()->done_; });
+		}
+		ok = write(pending.front()->batch_);
+		pending.pop_front();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		finished = true;
+		jobs.clear();
+	}
+	jobReady.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+	return ok;
+}
+
+#endif
@@ -0,0 +1,41 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include "TranscriptIndex.h"
+#include "RefGeneCompile.h"
+
+static void PrintUsage()
+{
+	std::cout << "\n"
+		"Usage:  crabber refgene-compile <refGene.tsv> <refGene.db>\n"
+		"\n"
+		"Input:\n"
+		"   <refGene.tsv>   track data downloaded from UCSC table browser\n"
+		"\n"
+		"Output:\n"
+		"   <refGene.db>    transcript database, which could be used in place of\n"
+		"                   <refGene.tsv> by annotate and loads without parsing\n"
+		<< std::endl;
+}
+
+int RefGeneCompile_main(int argc, char* const argv[])
+{
+	std::vector<std::string> args(argv, argv + argc);
+	std::vector<std::string> restArgs;
+	for (size_t i = 1; i < args.size(); ++i) {
+		restArgs.push_back(args[i]);
+	}
+	if (restArgs.size() < 2) {
+		PrintUsage();
+		return 1;
+	}
+
+	TranscriptIndex index;
+	if (!index.Load(restArgs[0])) {
+		return 1;
+	}
+	if (!index.Save(restArgs[1])) {
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef __REFGENE_COMPILE_H__
+#define __REFGENE_COMPILE_H__
+
+int RefGeneCompile_main(int argc, char* const argv[]);
+
+#endif
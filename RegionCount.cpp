@@ -1,103 +1,296 @@
 #include <string>
+#include <algorithm>
+#include <vector>
+#include <cstdlib>
 #include <iostream>
-#include <fstream>
+#include <unistd.h>
+#include "String.h"
 #include "Fasta.h"
-#include "LineSplit.h"
+#include "Bed.h"
+#include "BaseCount.h"
+#include "CompositionIndex.h"
+#include "Output.h"
+#include "Pipeline.h"
 #include "RegionCount.h"
 
-const int LINE_WIDTH = 60;
+static const char* const HEADER = "chrom\tstart\tend\tsize\tA\tC\tG\tT\tN\tother\tGC\n";
 
-static bool Process(const std::string& filename, const Fasta& fa)
+static size_t CountRange(const Fasta& fa, const CompositionIndex& index, size_t id, size_t pos, size_t size,
+	std::string& buffer, BaseCounts& counts)
 {
-	std::ifstream file(filename, std::ios::in);
-	if (!file.is_open()) {
-		std::cerr << "Error: Can not open file '" << filename << "'!" << std::endl;
-		return false;
+	if (size == 0) {
+		return 0;
+	}
+	if (index.IsLoaded()) {
+		return index.Count(fa, id, pos, size, buffer, counts);
 	}
+	return fa.ForEachSegment(id, pos, size, buffer, [&](StringRef seq) {
+			CountBases(seq.Data(), seq.Size(), counts);
+		});
+}
+
+static void OutputCounts(const std::string& chrom, long long start, long long end, size_t size,
+	const BaseCounts& counts, Output& out)
+{
+	uint64_t acgt = counts.a_ + counts.c_ + counts.g_ + counts.t_;
+	double gc = (acgt == 0 ? 0.0 : static_cast<double>(counts.c_ + counts.g_) / acgt);
+	out << chrom << '\t' << start << '\t' << end << '\t' << end - start << '\t'
+		<< counts.a_ << '\t' << counts.c_ << '\t' << counts.g_ << '\t' << counts.t_ << '\t'
+		<< counts.n_ << '\t' << size - acgt - counts.n_ << '\t' << gc << '\n';
+}
 
-	std::cout << "chrom\tstart\tend\tsize\tA\tC\tG\tT" << std::endl;
+// Tile [start, end) with windows of the given size every step bases, up to
+// the first one that reaches the end (clipped there); only the windows
+// starting in [first, last) are counted, first being on a step. Counts roll
+// from one window to the next: the bases leaving are subtracted and the ones
+// entering are added.
+static void CountWindows(const Fasta& fa, const CompositionIndex& index, size_t id, long long start, long long end,
+	long long first, long long last, long long window, long long step, std::string& buffer, Output& out)
+{
+	if (first > start && first - step + window >= end) {
+		return; // an earlier window reached the end
+	}
+	BaseCounts counts;
+	long long lastStart = first, lastEnd = first;
+	for (long long pos = first; pos < end && pos < last; pos += step) {
+		long long posEnd = std::min(pos + window, end);
+		if (pos < lastEnd) {
+			BaseCounts leaving;
+			CountRange(fa, index, id, lastStart, pos - lastStart, buffer, leaving);
+			counts.a_ -= leaving.a_;
+			counts.c_ -= leaving.c_;
+			counts.g_ -= leaving.g_;
+			counts.t_ -= leaving.t_;
+			counts.n_ -= leaving.n_;
+			CountRange(fa, index, id, lastEnd, posEnd - lastEnd, buffer, counts);
+		} else {
+			counts = BaseCounts();
+			CountRange(fa, index, id, pos, posEnd - pos, buffer, counts);
+		}
+		lastStart = pos;
+		lastEnd = posEnd;
 
-	size_t lineNo = 0;
-	std::string line;
-	while (std::getline(file, line)) {
-		++lineNo;
-		if (line.empty() || line[0] == '#') continue;
+		OutputCounts(fa.GetName(id), pos, posEnd, posEnd - pos, counts, out);
+		if (posEnd >= end) {
+			break;
+		}
+	}
+}
 
-		LineSplit sp;
-		sp.Split(line, '\t');
+// parts of BED regions counted together by a worker
+struct Batch
+{
+	std::vector<BedPart> parts_;
+	std::vector<size_t> ends_; // of the output of each part
+	std::vector<BaseCounts> counts_; // of parts of a region counted as a whole
+	std::vector<long long> sizes_;   // bases of them, -1 if the region is skipped
+	Output output_;
+	Output messages_; // skipped regions
+};
 
-		try {
-			std::string chrom = sp.GetField(0);
-			int start = stoi(sp.GetField(1));
-			int end = stoi(sp.GetField(2));
+const size_t BATCH_SIZE = 1024;
+const long long BATCH_BASES = 16 << 20;
+const long long BATCH_WINDOWS = 1 << 16;
 
-			if (start < 0) {
-				start = 0;
-			}
-			if (start >= end) {
-				std::cerr << "Skip invalid region: " << chrom << ":" << start + 1 << "-" << end << std::endl;
-				continue;
-			}
-			size_t len = fa.GetLength(chrom);
-			if (len == 0) {
-				std::cerr << "Skip non-existed sequence: '" << chrom << "'!" << std::endl;
-				continue;
+static void ProcessBatch(Batch& batch, const Fasta& fa, const CompositionIndex& index, long long window, long long step)
+{
+	std::string buffer;
+	batch.counts_.resize(batch.parts_.size());
+	batch.sizes_.resize(batch.parts_.size(), -1);
+	for (size_t i = 0; i < batch.parts_.size(); ++i) {
+		const BedPart& part = batch.parts_[i];
+		const BedRegion& region = part.region_;
+		long long start = region.start_;
+		int id = CheckRegion(fa, region.chrom_, start, region.end_, part.first_ ? &batch.messages_ : NULL);
+		if (id >= 0) {
+			if (window > 0) {
+				long long end = std::min(region.end_, static_cast<long long>(fa.GetLength(id)));
+				CountWindows(fa, index, id, start, end, part.start_, part.end_, window, step, buffer, batch.output_);
+			} else if (part.first_ && part.last_) {
+				BaseCounts counts;
+				size_t size = CountRange(fa, index, id, start, region.end_ - start, buffer, counts);
+				OutputCounts(region.chrom_, start, region.end_, size, counts, batch.output_);
+			} else {
+				batch.sizes_[i] = CountRange(fa, index, id, part.start_, part.end_ - part.start_, buffer, batch.counts_[i]);
 			}
-			if (start >= static_cast<int>(len)) {
-				std::cerr << "Skip non-existed region: " << chrom << ":" << start + 1 << "-" << end << std::endl;
+		}
+		batch.ends_.push_back(batch.output_.Str().size());
+	}
+}
+
+// Count the regions of a BED file, or with windows and no BED file, the
+// whole genome. Regions are cut into parts of at most a batch, which are
+// counted on worker threads and written in input order; the counts of a
+// region without windows are summed up over its parts.
+static bool Process(const std::string& filename, const Fasta& fa, const CompositionIndex& index,
+	long long window, long long step, int threads)
+{
+	BedReader bed;
+	if (!filename.empty() && !bed.Open(filename)) {
+		return false;
+	}
+
+	Output out(STDOUT_FILENO);
+	out << HEADER;
+
+	// parts start on a step and hold a bounded number of windows
+	long long partSize = BATCH_BASES;
+	if (window > 0) {
+		partSize = step * std::max(1LL, std::min(BATCH_BASES / step, BATCH_WINDOWS));
+	}
+	size_t nextId = 0; // next sequence to tile without a BED file
+	RegionSplitter splitter;
+	auto read = [&](Batch& batch) {
+		if (!filename.empty()) {
+			return bed.Read(batch.parts_, BATCH_SIZE, partSize, partSize, fa) > 0;
+		}
+		long long bases = 0;
+		BedPart part;
+		while (batch.parts_.size() < BATCH_SIZE && bases < partSize) {
+			if (!splitter.Next(part)) {
+				while (nextId < fa.GetCount() && fa.GetLength(nextId) == 0) {
+					++nextId;
+				}
+				if (nextId == fa.GetCount()) {
+					break;
+				}
+				BedRegion region;
+				region.chrom_ = fa.GetName(nextId);
+				region.start_ = 0;
+				region.end_ = fa.GetLength(nextId);
+				splitter.Reset(region, partSize, region.end_);
+				++nextId;
 				continue;
 			}
-
-			std::string seq = fa.GetSeq(chrom, start + 1, end - start);
-			size_t countA = 0, countC = 0, countG = 0, countT = 0;
-			for (size_t i = 0; i < seq.size(); ++i) {
-				if (seq[i] == 'A' || seq[i] == 'a') {
-					++countA;
-				} else if (seq[i] == 'C' || seq[i] == 'c') {
-					++countC;
-				} else if (seq[i] == 'G' || seq[i] == 'g') {
-					++countG;
-				} else if (seq[i] == 'T' || seq[i] == 't') {
-					++countT;
+			bases += part.end_ - part.start_;
+			batch.parts_.push_back(part);
+		}
+		return !batch.parts_.empty();
+	};
+	auto work = [&](Batch& batch) {
+		ProcessBatch(batch, fa, index, window, step);
+	};
+	BaseCounts counts; // of the region whose parts are being summed up
+	long long size = 0;
+	auto write = [&](Batch& batch) {
+		std::cerr << batch.messages_.Str() << std::flush;
+		const std::string& text = batch.output_.Str();
+		size_t begin = 0;
+		for (size_t i = 0; i < batch.parts_.size(); ++i) {
+			const BedPart& part = batch.parts_[i];
+			if (window == 0 && !(part.first_ && part.last_)) {
+				if (part.first_) {
+					counts = BaseCounts();
+					size = 0;
+				}
+				if (batch.sizes_[i] < 0) {
+					size = -1;
+				} else if (size >= 0) {
+					counts.a_ += batch.counts_[i].a_;
+					counts.c_ += batch.counts_[i].c_;
+					counts.g_ += batch.counts_[i].g_;
+					counts.t_ += batch.counts_[i].t_;
+					counts.n_ += batch.counts_[i].n_;
+					size += batch.sizes_[i];
+				}
+				if (part.last_ && size >= 0) {
+					const BedRegion& region = part.region_;
+					OutputCounts(region.chrom_, std::max(region.start_, 0LL), region.end_, size, counts, out);
 				}
 			}
-			std::cout << chrom << "\t" << start << "\t" << end << "\t" << end - start << "\t"
-				<< countA << "\t" << countC << "\t" << countG << "\t" << countT << std::endl;
-		} catch (const std::exception& e) {
-			std::cerr << "Unexpected error in line " << lineNo << " of file '" << filename << "'! " << e.what() << std::endl;
-			file.close();
-			return false;
+			out.Write(text.data() + begin, batch.ends_[i] - begin);
+			begin = batch.ends_[i];
 		}
-	}
+		return true;
+	};
+	RunPipeline<Batch>(threads, read, work, write);
 
-	file.close();
-	return true;
+	return !bed.Failed();
 }
+
 static void PrintUsage()
 {
 	std::cout << "\n"
-		"Usage:  crabber region-count <ref.fa> <region.bed>\n"
+		"Usage:  crabber region-count [options] <ref.fa> <region.bed>\n"
+		"        crabber region-count [options] --window <W> [--step <S>] [--bed <region.bed>] <ref.fa>\n"
 		"\n"
 		"Input:\n"
-		"   <ref.fa>        reference genome in FASTA format\n"
+		"   <ref.fa>        reference genome in FASTA format, or packed by fasta-pack\n"
 		"   <region.bed>    target region to count bases\n"
+		"\n"
+		"Options:\n"
+		"   -P              keep reference packed in memory (2 bits per base)\n"
+		"   --window <W>    count bases in windows of W bases over the whole genome,\n"
+		"                   or over the regions given by --bed\n"
+		"   --step <S>      start a window every S bases, default: W\n"
+		"   --bed <BED>     regions to tile with windows\n"
+		"   -t <N>          number of threads, default: 1\n"
+		"   -I              build the composition index '<ref.fa>.cidx' if it is\n"
+		"                   missing or stale; an existing one is always used\n"
 		<< std::endl;
 }
 
 int RegionCount_main(int argc, char* const argv[])
 {
+	bool packed = false;
+	bool buildIndex = false;
+	long long window = 0;
+	long long step = 0;
+	std::string bedFile;
+	int threads = 1;
+
 	std::vector<std::string> args(argv, argv + argc);
-	if (args.size() < 3) {
+	std::vector<std::string> restArgs;
+	for (size_t i = 1; i < args.size(); ++i) {
+		if (args[i] == "-P") {
+			packed = true;
+		} else if (args[i] == "-I") {
+			buildIndex = true;
+		} else if (args[i] == "--window" && i + 1 < args.size()) {
+			if (!ParseInt(args[++i], window) || window <= 0) {
+				std::cerr << "Error: Invalid window size '" << args[i] << "'!" << std::endl;
+				return 1;
+			}
+		} else if (args[i] == "--step" && i + 1 < args.size()) {
+			if (!ParseInt(args[++i], step) || step <= 0) {
+				std::cerr << "Error: Invalid step size '" << args[i] << "'!" << std::endl;
+				return 1;
+			}
+		} else if (args[i] == "--bed" && i + 1 < args.size()) {
+			bedFile = args[++i];
+		} else if (args[i] == "-t" && i + 1 < args.size()) {
+			threads = atoi(args[++i].c_str());
+			if (threads < 1) {
+				std::cerr << "Error: Invalid thread number '" << args[i] << "'!" << std::endl;
+				return 1;
+			}
+		} else {
+			restArgs.push_back(args[i]);
+		}
+	}
+	if (restArgs.size() < (window > 0 ? 1u : 2u)) {
 		PrintUsage();
 		return 1;
 	}
 
 	Fasta fa;
-	if (!fa.Load(args[1])) {
+	if (!fa.Load(restArgs[0], false, packed)) {
 		return 1;
 	}
 
-	if (!Process(args[2], fa)) {
+	CompositionIndex index;
+	std::string indexFile = restArgs[0] + ".cidx";
+	if (!index.Load(indexFile, fa) && buildIndex) {
+		index.Build(fa);
+		if (!index.Save(indexFile, fa)) {
+			std::cerr << "Warning: Can not write index '" << indexFile << "', continue without saving" << std::endl;
+		}
+	}
+
+	if (window == 0) {
+		bedFile = restArgs[1];
+	}
+	if (!Process(bedFile, fa, index, window, (step > 0 ? step : window), threads)) {
 		return 1;
 	}
 	return 0;
@@ -1,98 +1,154 @@
 #include <string>
 #include <iostream>
-#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+#include "String.h"
 #include "Fasta.h"
-#include "LineSplit.h"
+#include "Bed.h"
+#include "Output.h"
+#include "Pipeline.h"
 #include "RegionGet.h"
 
-const int LINE_WIDTH = 60;
+const long long LINE_WIDTH = 60;
+const long long COPY_BLOCK = 1 << 20; // bases copied into the output at a time
 
-static bool Process(const std::string& filename, const Fasta& fa)
+// parts of BED regions extracted together by a worker
+struct Batch
 {
-	std::ifstream file(filename, std::ios::in);
-	if (!file.is_open()) {
-		std::cerr << "Error: Can not open file '" << filename << "'!" << std::endl;
-		return false;
-	}
+	std::vector<BedPart> parts_;
+	Output output_;
+	Output messages_; // skipped regions
+};
 
-	size_t lineNo = 0;
-	std::string line;
-	while (std::getline(file, line)) {
-		++lineNo;
-		if (line.empty() || line[0] == '#') continue;
+const size_t BATCH_SIZE = 1024;
+const long long BATCH_BASES = 16 << 20;
 
-		LineSplit sp;
-		sp.Split(line, '\t');
-
-		try {
-			std::string chrom = sp.GetField(0);
-			int start = stoi(sp.GetField(1));
-			int end = stoi(sp.GetField(2));
+// Copy bases of [pos, pos + size) from the reference, upper-cased, straight
+// into the output buffer block by block, clipped at the end of the sequence
+static void OutputBases(const Fasta& fa, size_t id, long long pos, long long size, Output& out)
+{
+	long long len = fa.GetLength(id);
+	if (pos + size > len) {
+		size = (pos < len ? len - pos : 0);
+	}
+	for (long long i = 0; i < size; i += COPY_BLOCK) {
+		long long n = std::min(COPY_BLOCK, size - i);
+		fa.GetSeq(id, pos + i, n, out.Extend(n));
+	}
+}
 
-			if (start < 0) {
-				start = 0;
-			}
-			if (start >= end) {
-				std::cerr << "Skip invalid region: " << chrom << ":" << start + 1 << "-" << end << std::endl;
-				continue;
-			}
-			size_t len = fa.GetLength(chrom);
-			if (len == 0) {
-				std::cerr << "Skip non-existed sequence: '" << chrom << "'!" << std::endl;
-				continue;
-			}
-			if (start >= static_cast<int>(len)) {
-				std::cerr << "Skip non-existed region: " << chrom << ":" << start + 1 << "-" << end << std::endl;
-				continue;
-			}
+// out is the batch's output, or stdout itself when there is one thread
+static void ProcessBatch(Batch& batch, const Fasta& fa, long long width, Output& out)
+{
+	for (size_t k = 0; k < batch.parts_.size(); ++k) {
+		const BedPart& part = batch.parts_[k];
+		const BedRegion& region = part.region_;
+		long long start = region.start_;
+		int id = CheckRegion(fa, region.chrom_, start, region.end_, part.first_ ? &batch.messages_ : NULL);
+		if (id < 0) {
+			continue;
+		}
 
-			std::cout << ">" << chrom << ":" << start + 1 << "-" << end << std::endl;
+		if (part.first_) {
+			out << '>' << region.chrom_ << ':' << start + 1 << '-' << region.end_ << '\n';
+		}
 
-			if (end > static_cast<int>(len)) {
-				end = len;
-			}
-			for (int i = start; i < end; i += LINE_WIDTH) {
-				int size = LINE_WIDTH;
-				if (i + size > end) {
-					size = end - i;
-				}
-				std::cout << fa.GetSeq(chrom, i + 1, size) << std::endl;
+		long long end = std::min(part.end_, static_cast<long long>(fa.GetLength(id)));
+		if (width == 0) {
+			OutputBases(fa, id, part.start_, end - part.start_, out);
+			if (part.last_) {
+				out << '\n';
 			}
-		} catch (const std::exception& e) {
-			std::cerr << "Unexpected error in line " << lineNo << " of file '" << filename << "'! " << e.what() << std::endl;
-			file.close();
-			return false;
+			continue;
+		}
+		for (long long i = part.start_; i < end; i += width) {
+			OutputBases(fa, id, i, std::min(width, end - i), out);
+			out << '\n';
 		}
 	}
+}
+
+static bool Process(const std::string& filename, const Fasta& fa, long long width, int threads)
+{
+	BedReader bed;
+	if (!bed.Open(filename)) {
+		return false;
+	}
+
+	// parts of long regions end on line breaks
+	long long partSize = (width > 0 ? std::max(width, BATCH_BASES / width * width) : BATCH_BASES);
+	Output out(STDOUT_FILENO);
+	auto read = [&](Batch& batch) {
+		return bed.Read(batch.parts_, BATCH_SIZE, BATCH_BASES, partSize, fa) > 0;
+	};
+	auto work = [&](Batch& batch) {
+		ProcessBatch(batch, fa, width, (threads > 1 ? batch.output_ : out));
+	};
+	auto write = [&](Batch& batch) {
+		std::cerr << batch.messages_.Str() << std::flush;
+		out << batch.output_.Str();
+		return true;
+	};
+	RunPipeline<Batch>(threads, read, work, write);
 
-	file.close();
-	return true;
+	return !bed.Failed();
 }
+
 static void PrintUsage()
 {
 	std::cout << "\n"
-		"Usage:  crabber region-get <ref.fa> <region.bed>\n"
+		"Usage:  crabber region-get [options] <ref.fa> <region.bed>\n"
 		"\n"
 		"Input:\n"
-		"   <ref.fa>        reference genome in FASTA format\n"
+		"   <ref.fa>        reference genome in FASTA format, or packed by fasta-pack\n"
 		"   <region.bed>    target region to extract sequences\n"
+		"\n"
+		"Options:\n"
+		"   -P              keep reference packed in memory (2 bits per base)\n"
+		"   --width <N>     bases per output line, 0 for one line per region, default: 60\n"
+		"   -t <N>          number of threads, default: 1\n"
 		<< std::endl;
 }
 
 int RegionGet_main(int argc, char* const argv[])
 {
+	bool packed = false;
+	int threads = 1;
+	long long width = LINE_WIDTH;
+
 	std::vector<std::string> args(argv, argv + argc);
-	if (args.size() < 3) {
+	std::vector<std::string> restArgs;
+	for (size_t i = 1; i < args.size(); ++i) {
+		if (args[i] == "-P") {
+			packed = true;
+		} else if (args[i] == "--width" && i + 1 < args.size()) {
+			if (!ParseInt(args[++i], width) || width < 0) {
+				std::cerr << "Error: Invalid line width '" << args[i] << "'!" << std::endl;
+				return 1;
+			}
+		} else if (args[i] == "-t" && i + 1 < args.size()) {
+			threads = atoi(args[++i].c_str());
+			if (threads < 1) {
+				std::cerr << "Error: Invalid thread number '" << args[i] << "'!" << std::endl;
+				return 1;
+			}
+		} else {
+			restArgs.push_back(args[i]);
+		}
+	}
+	if (restArgs.size() < 2) {
 		PrintUsage();
 		return 1;
 	}
 
 	Fasta fa;
-	if (!fa.Load(args[1])) {
+	if (!fa.Load(restArgs[0], false, packed)) {
 		return 1;
 	}
 
-	if (!Process(args[2], fa)) {
+	if (!Process(restArgs[1], fa, width, threads)) {
 		return 1;
 	}
 	return 0;
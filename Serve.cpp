@@ -0,0 +1,272 @@
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <system_error>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "Serve.h"
+#include "Annotate.h"
+#include "Annotator.h"
+#include "String.h"
+#include "LineSplit.h"
+#include "Output.h"
+
+const size_t MAX_LINE = 1 << 20; // bytes of a request line
+
+// Answer one request line (VCF or TSV columns chrom, pos, id/end, ref, alt,
+// ...) with its annotation rows in the format of 'crabber annotate', or an
+// error line, followed by an empty line. A '#' line gets no rows.
+static void Answer(const Annotator& annotator, StringRef line, LineSplit& fields,
+		VariantBatch& batch, AnnotationResult& result, Output& out)
+{
+	if (line.Size() == 0) {
+		out << "Error: Empty request\n\n";
+		return;
+	}
+	if (line[0] == '#') {
+		out << '\n';
+		return;
+	}
+	int genomePos;
+	if (fields.Split(line, '\t', 6) < 5 || !ParseInt(fields.GetField(1), genomePos)) {
+		out << "Error: Invalid position\n\n";
+		return;
+	}
+	int chromId = annotator.GetChromId(fields.GetField(0).ToString());
+	if (chromId >= 0) {
+		batch.Clear();
+		result.Clear();
+		batch.Add(chromId, genomePos - 1, fields.GetField(3).ToString(), fields.GetField(4).ToString());
+		annotator.Annotate(batch, result);
+		if (!result.missingSequences_.empty()) {
+			out << "Error: Can not found sequence '" << annotator.GetChromName(chromId) << "' in ref fasta\n";
+		}
+		for (size_t row = 0; row < result.GetCount(); ++row) {
+			OutputAnnotation(fields, result, row, out);
+		}
+		if (result.failed_) {
+			out << "Error: " << result.error_ << '\n';
+		}
+	}
+	out << '\n';
+}
+
+// Bounds the number of connections annotating at the same time; a waiting
+// or idle client holds its own thread but no slot.
+class Slots
+{
+public:
+	explicit Slots(int count): free_(count) { }
+
+	void Acquire()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		ready_.wait(lock, [&]() { return free_ > 0; });
+		--free_;
+	}
+
+	void Release()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			++free_;
+		}
+		ready_.notify_one();
+	}
+private:
+	std::mutex mutex_;
+	std::condition_variable ready_;
+	int free_;
+};
+
+// serve requests of a client until it closes the connection, or sends a line
+// longer than MAX_LINE
+static void ServeClient(const Annotator& annotator, Slots& slots, int fd)
+{
+	Output out(fd, 1 << 16);
+	LineSplit fields;
+	VariantBatch batch;
+	AnnotationResult result;
+	std::string buffer;
+	size_t done = 0; // bytes of buffer already answered
+	char chunk[1 << 16];
+	for (;;) {
+		ssize_t n = read(fd, chunk, sizeof(chunk));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		buffer.erase(0, done);
+		buffer.append(chunk, n);
+		done = 0;
+		bool locked = false;
+		for (;;) {
+			const char* begin = buffer.data() + done;
+			const char* eol = static_cast<const char*>(memchr(begin, '\n', buffer.size() - done));
+			if (!eol) {
+				break;
+			}
+			done = eol - buffer.data() + 1;
+			size_t size = eol - begin;
+			if (size > 0 && begin[size - 1] == '\r') {
+				--size;
+			}
+			if (!locked) {
+				slots.Acquire();
+				locked = true;
+			}
+			Answer(annotator, StringRef(begin, size), fields, batch, result, out);
+		}
+		if (locked) {
+			slots.Release();
+		}
+		bool tooLong = (buffer.size() - done > MAX_LINE);
+		if (tooLong) {
+			out << "Error: Request line is longer than " << MAX_LINE << " bytes\n\n";
+		}
+		// pipelined requests are answered together
+		if (!out.Flush() || tooLong) {
+			break;
+		}
+	}
+	close(fd);
+}
+
+static int Listen(const std::string& path)
+{
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		std::cerr << "Error: Socket path '" << path << "' is too long!" << std::endl;
+		return -1;
+	}
+	strcpy(addr.sun_path, path.c_str());
+
+	// a stale socket of an earlier server, but never any other file
+	struct stat st;
+	if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path.c_str());
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		std::cerr << "Error: Can not create socket: " << strerror(errno) << std::endl;
+		return -1;
+	}
+	if (bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+		std::cerr << "Error: Can not listen on socket '" << path << "': " << strerror(errno) << std::endl;
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void PrintUsage()
+{
+	std::cout << "\n"
+		"Usage:  crabber serve [options] --socket <path> <refGene.tsv> <ref.fa>\n"
+		"\n"
+		"Input:\n"
+		"   <refGene.tsv>   track data downloaded from UCSC table browser, or compiled\n"
+		"                   by refgene-compile\n"
+		"   <ref.fa>        reference genome in FASTA format, or packed by fasta-pack\n"
+		"\n"
+		"Loads the reference and transcripts once and annotates variants sent to a\n"
+		"Unix domain socket. Each request is a line in the columns of annotate input\n"
+		"(chrom, pos, id, ref, alt...), and is answered with its annotation rows\n"
+		"followed by an empty line; every line is answered, a '#' line with no rows,\n"
+		"and an invalid one with an 'Error:' line. A connection is closed after a\n"
+		"line of more than 1 MB.\n"
+		"\n"
+		"Options:\n"
+		"   --socket <path> Unix domain socket to listen on\n"
+		"   -1              output only first matched script, default to output all\n"
+		"   -P              keep reference packed in memory (2 bits per base)\n"
+		"   -t <N>          number of requests annotated concurrently, default: 4\n"
+		<< std::endl;
+}
+
+int Serve_main(int argc, char* const argv[])
+{
+	std::string socketPath;
+	bool outputFirstOnly = false;
+	bool packed = false;
+	int threads = 4;
+
+	std::vector<std::string> args(argv, argv + argc);
+	std::vector<std::string> restArgs;
+	for (size_t i = 1; i < args.size(); ++i) {
+		if (args[i] == "--socket" && i + 1 < args.size()) {
+			socketPath = args[++i];
+		} else if (args[i] == "-1") {
+			outputFirstOnly = true;
+		} else if (args[i] == "-P") {
+			packed = true;
+		} else if (args[i] == "-t" && i + 1 < args.size()) {
+			threads = atoi(args[++i].c_str());
+			if (threads < 1) {
+				std::cerr << "Error: Invalid thread number '" << args[i] << "'!" << std::endl;
+				return 1;
+			}
+		} else {
+			restArgs.push_back(args[i]);
+		}
+	}
+	if (restArgs.size() < 2 || socketPath.empty()) {
+		PrintUsage();
+		return 1;
+	}
+
+	Fasta fa;
+	if (!fa.Load(restArgs[1], false, packed)) {
+		return 1;
+	}
+	TranscriptIndex index;
+	if (!index.Load(restArgs[0])) {
+		return 1;
+	}
+	Annotator annotator(fa, index);
+	annotator.SetFirstOnly(outputFirstOnly);
+
+	int listenFd = Listen(socketPath);
+	if (listenFd < 0) {
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN); // a client gone away only ends its connection
+	std::cerr << "Listening on '" << socketPath << "'" << std::endl;
+
+	// a thread per connection, at most 'threads' of them annotating at once
+	Slots slots(threads);
+	for (;;) {
+		int fd = accept(listenFd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			std::cerr << "Error: Can not accept connection: " << strerror(errno) << std::endl;
+			break;
+		}
+		try {
+			std::thread(ServeClient, std::cref(annotator), std::ref(slots), fd).detach();
+		} catch (const std::system_error& e) {
+			std::cerr << "Error: Can not serve connection: " << e.what() << std::endl;
+			close(fd);
+		}
+	}
+	close(listenFd);
+	return 1;
+}
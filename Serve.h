@@ -0,0 +1,6 @@
+#ifndef __SERVE_H__
+#define __SERVE_H__
+
+int Serve_main(int argc, char* const argv[]);
+
+#endif
@@ -1,5 +1,46 @@
+#include <climits>
 #include "String.h"
 
+bool ParseInt(StringRef s, long long& value)
+{
+	const char* p = s.Data();
+	const char* end = p + s.Size();
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		++p;
+	}
+	if (p == end) {
+		return false;
+	}
+
+	unsigned long long n = 0;
+	for (; p < end; ++p) {
+		unsigned int d = static_cast<unsigned char>(*p) - '0';
+		if (d > 9 || n > (ULLONG_MAX - d) / 10) {
+			return false;
+		}
+		n = n * 10 + d;
+	}
+
+	unsigned long long limit = static_cast<unsigned long long>(LLONG_MAX) + (negative ? 1 : 0);
+	if (n > limit) {
+		return false;
+	}
+	value = (negative ? -static_cast<long long>(n - 1) - 1 : static_cast<long long>(n));
+	return true;
+}
+
+bool ParseInt(StringRef s, int& value)
+{
+	long long n;
+	if (!ParseInt(s, n) || n < INT_MIN || n > INT_MAX) {
+		return false;
+	}
+	value = static_cast<int>(n);
+	return true;
+}
+
 std::string TrimLeft(const std::string& str, const std::string& drop)
 {
 	std::string::size_type pos = str.find_first_not_of(drop);
@@ -2,6 +2,37 @@
 #define __STR_FUNC_H__
 
 #include <string>
+#include <cstring>
+
+// Non-owning view of characters, e.g. a field of an input line or a range of
+// the reference. It is only valid while the underlying storage is.
+class StringRef
+{
+public:
+	StringRef(): data_(NULL), size_(0) { }
+	StringRef(const char* data, size_t size): data_(data), size_(size) { }
+	StringRef(const std::string& s): data_(s.data()), size_(s.size()) { }
+
+	const char* Data() const { return data_; }
+	size_t Size() const { return size_; }
+	bool Empty() const { return size_ == 0; }
+	char operator[](size_t i) const { return data_[i]; }
+
+	std::string ToString() const { return std::string(data_, size_); }
+
+	bool operator==(const StringRef& s) const { return size_ == s.size_ && memcmp(data_, s.data_, size_) == 0; }
+	bool operator!=(const StringRef& s) const { return !(*this == s); }
+	bool operator==(const char* s) const { return *this == StringRef(s, strlen(s)); }
+	bool operator!=(const char* s) const { return !(*this == s); }
+private:
+	const char* data_;
+	size_t size_;
+};
+
+// Parse a whole field as a decimal integer with optional sign. Returns false,
+// without throwing, on empty input, any other character or overflow.
+bool ParseInt(StringRef s, long long& value);
+bool ParseInt(StringRef s, int& value);
 
 std::string TrimLeft(const std::string& str, const std::string& drop = " \t");
 std::string Trim_right(const std::string& str, const std::string& drop = " \t");
@@ -1,19 +1,53 @@
 #include "Transcript.h"
+#include "String.h"
 #include "LineSplit.h"
 
 bool Transcript::SetExons(int exonCount, const std::string& exonStarts, const std::string& exonEnds)
 {
-	std::vector<size_t> pos, pos2;
-	pos.resize(exonCount + 1);
-	pos2.resize(exonCount + 1);
-
 	LineSplit sp, sp2;
-	sp.Split(exonStarts, ',');
-	sp2.Split(exonEnds, ',');
+	if (static_cast<int>(sp.Split(exonStarts, ',')) < exonCount || static_cast<int>(sp2.Split(exonEnds, ',')) < exonCount) {
+		return false;
+	}
+	exons_.clear();
+	exons_.reserve(exonCount);
 	for (int i = 0; i < exonCount; ++i) {
-		exons_.push_back(std::make_pair(
-					stoi(sp.GetField(i)) - txStart_,
-					stoi(sp2.GetField(i)) - txStart_));
+		int start, end;
+		if (!ParseInt(sp.GetField(i), start) || !ParseInt(sp2.GetField(i), end)) {
+			exons_.clear();
+			return false;
+		}
+		exons_.push_back(std::make_pair(start - txStart_, end - txStart_));
 	}
 	return true;
 }
+
+void Transcript::UpdateCoords()
+{
+	exonOffsets_.resize(exons_.size());
+	int offset = 0;
+	for (size_t i = 0; i < exons_.size(); ++i) {
+		exonOffsets_[i] = offset;
+		offset += exons_[i].second - exons_[i].first;
+	}
+
+	cdsStartTxPos_ = cdsEndTxPos_ = 0;
+	if (cdsStart_ != cdsEnd_) {
+		cdsStartTxPos_ = GetTxPos(cdsStart_ - txStart_);
+		int last = GetTxPos(cdsEnd_ - txStart_ - 1);
+		cdsEndTxPos_ = (last < 0 ? -1 : last + 1);
+		if (cdsStartTxPos_ < 0 || cdsEndTxPos_ < 0) {
+			cdsStartTxPos_ = cdsEndTxPos_ = -1;
+		}
+	}
+}
+
+int Transcript::GetTxPos(int pos) const
+{
+	auto it = std::upper_bound(exons_.begin(), exons_.end(), pos, [](int p, const std::pair<int, int>& exon) {
+			return p < exon.second;
+		});
+	if (it == exons_.end() || pos < it->first) {
+		return -1;
+	}
+	return exonOffsets_[it - exons_.begin()] + (pos - it->first);
+}
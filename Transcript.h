@@ -4,18 +4,29 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <algorithm>
 
 class Transcript
 {
 public:
-	Transcript(): txStart_(0), txEnd_(0) { }
+	Transcript(): txStart_(0), txEnd_(0), cdsStart_(0), cdsEnd_(0), cdsStartTxPos_(0), cdsEndTxPos_(0) { }
 
 	Transcript(const std::string& name, const std::string& name2, int txStart, int txEnd):
-		name_(name), name2_(name2), txStart_(txStart), txEnd_(txEnd)
+		name_(name), name2_(name2), txStart_(txStart), txEnd_(txEnd), cdsStart_(0), cdsEnd_(0),
+		cdsStartTxPos_(0), cdsEndTxPos_(0)
 	{
 	}
 
 	bool SetExons(int exonCount, const std::string& exonStarts, const std::string& exonEnds);
+
+	// Precompute the spliced offset of each exon and the CDS anchors, once
+	// exons and CDS are set. The anchors are -1 if the CDS does not start
+	// and end in exons.
+	void UpdateCoords();
+
+	// position in the spliced transcript of pos (relative to txStart_), or
+	// -1 if it is not in an exon; a binary search over the exons
+	int GetTxPos(int pos) const;
 public:
 	std::string name_;
 	std::string name2_;
@@ -24,10 +35,10 @@ public:
 	int txEnd_;
 	int cdsStart_;
 	int cdsEnd_;
-	int exonCount_;
-	std::string exonStarts_;
-	std::string exonEnds_;
-	std::vector<std::pair<int, int>> exons_;
+	std::vector<std::pair<int, int>> exons_; // relative to txStart_
+	std::vector<int> exonOffsets_; // spliced length before each exon
+	int cdsStartTxPos_; // spliced position of the first CDS base
+	int cdsEndTxPos_;   // and after the last one
 };
 
 #endif
@@ -0,0 +1,515 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+#include <stdint.h>
+#include "String.h"
+#include "LineSplit.h"
+#include "MappedFile.h"
+#include "TranscriptIndex.h"
+
+// Layout of the transcript database, in host byte order:
+//   DbHeader | DbChrom x chroms | DbTranscript x transcripts | exons | strings
+// Transcripts of a chromosome are consecutive and sorted as in the index,
+// exons are (start, end) pairs relative to txStart, and names point into the
+// string pool. The tree is not stored, loading rebuilds it.
+static const char DB_MAGIC[8] = { 'C', 'R', 'A', 'B', 'T', 'X', 'D', 'B' };
+static const uint32_t DB_VERSION = 2;
+
+struct DbHeader
+{
+	char magic_[8];
+	uint32_t version_;
+	uint32_t chromCount_;
+	uint64_t transCount_;
+	uint64_t exonCount_;
+	uint64_t stringsOffset_;
+	uint64_t stringsSize_;
+};
+
+struct DbChrom
+{
+	uint64_t nameOffset_;
+	uint64_t nameLength_;
+	uint64_t firstTrans_;
+	uint64_t transCount_;
+};
+
+struct DbTranscript
+{
+	uint64_t nameOffset_;
+	uint64_t name2Offset_;
+	uint64_t strandOffset_;
+	uint32_t nameLength_;
+	uint32_t name2Length_;
+	uint32_t strandLength_;
+	int32_t txStart_;
+	int32_t txEnd_;
+	int32_t cdsStart_;
+	int32_t cdsEnd_;
+	int32_t reserved_;
+	uint64_t order_;
+	uint64_t firstExon_;
+	uint64_t exonCount_;
+};
+
+// exons in order, not overlapping and inside the transcript; the same check
+// runs on refGene tables and databases, so any table that loads compiles into
+// a database that loads
+static bool ValidTranscript(const Transcript& item)
+{
+	if (item.txStart_ > item.txEnd_) {
+		return false;
+	}
+	int last = 0;
+	for (size_t i = 0; i < item.exons_.size(); ++i) {
+		if (item.exons_[i].first < last || item.exons_[i].second < item.exons_[i].first) {
+			return false;
+		}
+		last = item.exons_[i].second;
+	}
+	return last <= item.txEnd_ - item.txStart_;
+}
+
+static bool LoadRefGene(const std::string& filename, std::map<std::string, std::vector<Transcript>>& data)
+{
+	std::ifstream file(filename, std::ios::in);
+	if (!file.is_open()) {
+		std::cerr << "Can not open file '" << filename << "'!" << std::endl;
+		return false;
+	}
+
+	//std::cerr << "Loading refGene '" << filename << "'" << std::endl;
+	time_t t0 = time(NULL);
+	size_t lineNo = 0;
+	int count = 0;
+	LineSplit sp;
+	std::string line;
+	while (std::getline(file, line)) {
+		++lineNo;
+
+		time_t t = time(NULL);
+		if (t != t0) {
+			//std::cerr << "  " << count << " record(s) loaded\r" << std::flush;
+			t0 = t;
+		}
+
+		if (line.empty() || line[0] == '#') continue;
+
+		sp.Split(line, '\t');
+
+		StringRef cdsStartStat = sp.GetField(13);
+		StringRef cdsEndStat = sp.GetField(14);
+		if (cdsStartStat != "cmpl" || cdsEndStat != "cmpl") continue;
+
+		int txStart, txEnd, cdsStart, cdsEnd, exonCount;
+		if (!ParseInt(sp.GetField(4), txStart) || !ParseInt(sp.GetField(5), txEnd)
+				|| !ParseInt(sp.GetField(6), cdsStart) || !ParseInt(sp.GetField(7), cdsEnd)
+				|| !ParseInt(sp.GetField(8), exonCount) || exonCount <= 0) {
+			std::cerr << "Unexpected error in line " << lineNo << " of file '" << filename << "'! Invalid position" << std::endl;
+			file.close();
+			return false;
+		}
+		std::string name = sp.GetField(1).ToString();
+		std::string name2 = sp.GetField(12).ToString();
+		std::string chrom = sp.GetField(2).ToString();
+		std::string strand = sp.GetField(3).ToString();
+		std::string exonStarts = sp.GetField(9).ToString();
+		std::string exonEnds = sp.GetField(10).ToString();
+
+		Transcript item(name, name2, txStart, txEnd);
+		item.strand_ = strand;
+		item.cdsStart_ = cdsStart;
+		item.cdsEnd_ = cdsEnd;
+		if (!item.SetExons(exonCount, exonStarts, exonEnds) || !ValidTranscript(item)) {
+			std::cerr << "Invalid exon info at line " << lineNo << std::endl;
+			continue;
+		}
+		item.UpdateCoords();
+		data[chrom].push_back(item);
+
+		++count;
+
+	}
+	//std::cerr << "Total " << count << " record(s) loaded" << std::endl;
+	file.close();
+	return true;
+}
+
+bool TranscriptIndex::Load(const std::string& filename)
+{
+	MappedFile file;
+	if (file.Open(filename) && file.Size() >= sizeof(DB_MAGIC) && memcmp(file.Data(), DB_MAGIC, sizeof(DB_MAGIC)) == 0) {
+		if (!LoadDatabase(file.Data(), file.Size())) {
+			std::cerr << "Error: Invalid transcript database '" << filename << "'!" << std::endl;
+			return false;
+		}
+		return true;
+	}
+	file.Close();
+
+	std::map<std::string, std::vector<Transcript>> data;
+	if (!LoadRefGene(filename, data)) {
+		return false;
+	}
+	Build(data);
+	return true;
+}
+
+bool TranscriptIndex::LoadDatabase(const char* data, size_t size)
+{
+	chroms_.clear();
+	index_.clear();
+
+	const DbHeader* header = reinterpret_cast<const DbHeader*>(data);
+	if (size < sizeof(DbHeader) || header->version_ != DB_VERSION) {
+		return false;
+	}
+	uint64_t chromsOffset = sizeof(DbHeader);
+	uint64_t transOffset = chromsOffset + header->chromCount_ * sizeof(DbChrom);
+	uint64_t exonsOffset = transOffset + header->transCount_ * sizeof(DbTranscript);
+	uint64_t exonsEnd = exonsOffset + header->exonCount_ * 2 * sizeof(int32_t);
+	if (header->transCount_ > size || header->exonCount_ > size || exonsEnd > header->stringsOffset_
+			|| header->stringsOffset_ > size || header->stringsSize_ > size - header->stringsOffset_) {
+		return false;
+	}
+	const DbChrom* chroms = reinterpret_cast<const DbChrom*>(data + chromsOffset);
+	const DbTranscript* trans = reinterpret_cast<const DbTranscript*>(data + transOffset);
+	const int32_t* exons = reinterpret_cast<const int32_t*>(data + exonsOffset);
+	const char* strings = data + header->stringsOffset_;
+	auto validString = [&](uint64_t offset, uint64_t length) {
+		return offset <= header->stringsSize_ && length <= header->stringsSize_ - offset;
+	};
+
+	chroms_.resize(header->chromCount_);
+	for (size_t id = 0; id < chroms_.size(); ++id) {
+		const DbChrom& c = chroms[id];
+		if (!validString(c.nameOffset_, c.nameLength_) || c.firstTrans_ > header->transCount_
+				|| c.transCount_ > header->transCount_ - c.firstTrans_) {
+			chroms_.clear();
+			index_.clear();
+			return false;
+		}
+		Chrom& chrom = chroms_[id];
+		chrom.name_.assign(strings + c.nameOffset_, c.nameLength_);
+		chrom.trans_.resize(c.transCount_);
+		chrom.order_.resize(c.transCount_);
+		for (size_t i = 0; i < c.transCount_; ++i) {
+			const DbTranscript& t = trans[c.firstTrans_ + i];
+			if (!validString(t.nameOffset_, t.nameLength_) || !validString(t.name2Offset_, t.name2Length_)
+					|| !validString(t.strandOffset_, t.strandLength_) || t.firstExon_ > header->exonCount_
+					|| t.exonCount_ > header->exonCount_ - t.firstExon_) {
+				chroms_.clear();
+				index_.clear();
+				return false;
+			}
+			Transcript& item = chrom.trans_[i];
+			item.name_.assign(strings + t.nameOffset_, t.nameLength_);
+			item.name2_.assign(strings + t.name2Offset_, t.name2Length_);
+			item.strand_.assign(strings + t.strandOffset_, t.strandLength_);
+			item.txStart_ = t.txStart_;
+			item.txEnd_ = t.txEnd_;
+			item.cdsStart_ = t.cdsStart_;
+			item.cdsEnd_ = t.cdsEnd_;
+			item.exons_.resize(t.exonCount_);
+			for (size_t k = 0; k < t.exonCount_; ++k) {
+				item.exons_[k].first = exons[(t.firstExon_ + k) * 2];
+				item.exons_[k].second = exons[(t.firstExon_ + k) * 2 + 1];
+			}
+			if (!ValidTranscript(item) || (i > 0 && item.txStart_ < chrom.trans_[i - 1].txStart_)) {
+				chroms_.clear();
+				index_.clear();
+				return false;
+			}
+			item.UpdateCoords();
+			chrom.order_[i] = t.order_;
+		}
+		chrom.maxLevel_ = BuildTree(chrom); // O(n), the transcripts are already sorted
+		index_[chrom.name_] = id;
+	}
+	return true;
+}
+
+bool TranscriptIndex::Save(const std::string& filename) const
+{
+	std::string tempFile = filename + ".tmp";
+	std::ofstream file(tempFile, std::ios::out | std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "Error: Can not open file '" << tempFile << "'!" << std::endl;
+		return false;
+	}
+
+	std::string strings;
+	auto addString = [&strings](const std::string& s) {
+		uint64_t offset = strings.size();
+		strings += s;
+		return offset;
+	};
+
+	std::vector<DbChrom> chroms(chroms_.size());
+	std::vector<DbTranscript> trans;
+	std::vector<int32_t> exons;
+	for (size_t id = 0; id < chroms_.size(); ++id) {
+		const Chrom& chrom = chroms_[id];
+		DbChrom& c = chroms[id];
+		c.nameOffset_ = addString(chrom.name_);
+		c.nameLength_ = chrom.name_.size();
+		c.firstTrans_ = trans.size();
+		c.transCount_ = chrom.trans_.size();
+		for (size_t i = 0; i < chrom.trans_.size(); ++i) {
+			const Transcript& item = chrom.trans_[i];
+			DbTranscript t;
+			memset(&t, 0, sizeof(t));
+			t.nameOffset_ = addString(item.name_);
+			t.nameLength_ = item.name_.size();
+			t.name2Offset_ = addString(item.name2_);
+			t.name2Length_ = item.name2_.size();
+			t.strandOffset_ = addString(item.strand_);
+			t.strandLength_ = item.strand_.size();
+			t.txStart_ = item.txStart_;
+			t.txEnd_ = item.txEnd_;
+			t.cdsStart_ = item.cdsStart_;
+			t.cdsEnd_ = item.cdsEnd_;
+			t.order_ = chrom.order_[i];
+			t.firstExon_ = exons.size() / 2;
+			t.exonCount_ = item.exons_.size();
+			for (size_t k = 0; k < item.exons_.size(); ++k) {
+				exons.push_back(item.exons_[k].first);
+				exons.push_back(item.exons_[k].second);
+			}
+			trans.push_back(t);
+		}
+	}
+
+	DbHeader header;
+	memcpy(header.magic_, DB_MAGIC, sizeof(DB_MAGIC));
+	header.version_ = DB_VERSION;
+	header.chromCount_ = chroms.size();
+	header.transCount_ = trans.size();
+	header.exonCount_ = exons.size() / 2;
+	header.stringsOffset_ = sizeof(DbHeader) + chroms.size() * sizeof(DbChrom)
+		+ trans.size() * sizeof(DbTranscript) + exons.size() * sizeof(int32_t);
+	header.stringsSize_ = strings.size();
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(chroms.data()), chroms.size() * sizeof(DbChrom));
+	file.write(reinterpret_cast<const char*>(trans.data()), trans.size() * sizeof(DbTranscript));
+	file.write(reinterpret_cast<const char*>(exons.data()), exons.size() * sizeof(int32_t));
+	file << strings;
+	file.close();
+	if (file.fail()) {
+		std::cerr << "Error: Failed to write file '" << tempFile << "'!" << std::endl;
+		unlink(tempFile.c_str());
+		return false;
+	}
+	if (rename(tempFile.c_str(), filename.c_str()) != 0) {
+		std::cerr << "Error: Can not rename '" << tempFile << "' to '" << filename << "'!" << std::endl;
+		unlink(tempFile.c_str());
+		return false;
+	}
+	return true;
+}
+
+void TranscriptIndex::Build(std::map<std::string, std::vector<Transcript>>& data)
+{
+	chroms_.clear();
+	index_.clear();
+	chroms_.resize(data.size());
+
+	size_t id = 0;
+	for (auto it = data.begin(); it != data.end(); ++it, ++id) {
+		std::vector<Transcript>& trans = it->second;
+		std::vector<size_t> order(trans.size());
+		for (size_t i = 0; i < order.size(); ++i) {
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [&trans](size_t a, size_t b) {
+				return trans[a].txStart_ < trans[b].txStart_;
+			});
+
+		Chrom& chrom = chroms_[id];
+		chrom.trans_.resize(trans.size());
+		for (size_t i = 0; i < order.size(); ++i) {
+			std::swap(chrom.trans_[i], trans[order[i]]);
+		}
+		chrom.order_.swap(order);
+		chrom.maxLevel_ = BuildTree(chrom);
+		chrom.name_ = it->first;
+		index_[it->first] = id;
+	}
+	data.clear();
+}
+
+int TranscriptIndex::BuildTree(Chrom& chrom)
+{
+	const std::vector<Transcript>& a = chrom.trans_;
+	std::vector<int>& maxEnd = chrom.maxEnd_;
+	size_t n = a.size();
+	maxEnd.resize(n);
+	if (n == 0) {
+		return -1;
+	}
+
+	size_t lastIndex = 0;
+	int last = 0;
+	for (size_t i = 0; i < n; i += 2) { // leaves
+		lastIndex = i;
+		last = maxEnd[i] = a[i].txEnd_;
+	}
+	int k = 1;
+	for (; (static_cast<size_t>(1) << k) <= n; ++k) {
+		size_t x = static_cast<size_t>(1) << (k - 1);
+		size_t step = x << 2;
+		for (size_t i = (x << 1) - 1; i < n; i += step) {
+			int endLeft = maxEnd[i - x];
+			int endRight = (i + x < n ? maxEnd[i + x] : last);
+			maxEnd[i] = std::max(a[i].txEnd_, std::max(endLeft, endRight));
+		}
+		lastIndex = ((lastIndex >> k) & 1) ? lastIndex - x : lastIndex + x;
+		if (lastIndex < n && maxEnd[lastIndex] > last) {
+			last = maxEnd[lastIndex];
+		}
+	}
+	return k - 1;
+}
+
+bool TranscriptIndex::Has(const std::string& chrom) const
+{
+	return (index_.find(chrom) != index_.end());
+}
+
+int TranscriptIndex::GetId(const std::string& chrom) const
+{
+	auto it = index_.find(chrom);
+	if (it == index_.end()) {
+		return -1;
+	}
+	return it->second;
+}
+
+size_t TranscriptIndex::Find(size_t chromId, int start, int end, std::vector<const Transcript*>& hits) const
+{
+	hits.clear();
+	if (chromId >= chroms_.size() || chroms_[chromId].trans_.empty()) {
+		return 0;
+	}
+	const Chrom& chrom = chroms_[chromId];
+	const std::vector<Transcript>& a = chrom.trans_;
+	size_t n = a.size();
+
+	struct Node
+	{
+		size_t x;
+		int k;
+		bool leftDone;
+	};
+	Node stack[64];
+	int top = 0;
+	stack[top++] = { (static_cast<size_t>(1) << chrom.maxLevel_) - 1, chrom.maxLevel_, false };
+
+	while (top > 0) {
+		Node z = stack[--top];
+		if (z.k <= 3) { // small subtree, scan it
+			size_t i0 = z.x >> z.k << z.k;
+			size_t i1 = i0 + (static_cast<size_t>(1) << (z.k + 1)) - 1;
+			if (i1 > n) {
+				i1 = n;
+			}
+			for (size_t i = i0; i < i1 && a[i].txStart_ < end; ++i) {
+				if (start < a[i].txEnd_) {
+					hits.push_back(&a[i]);
+				}
+			}
+		} else if (!z.leftDone) {
+			size_t y = z.x - (static_cast<size_t>(1) << (z.k - 1));
+			stack[top++] = { z.x, z.k, true };
+			if (y >= n || chrom.maxEnd_[y] > start) {
+				stack[top++] = { y, z.k - 1, false };
+			}
+		} else if (z.x < n && a[z.x].txStart_ < end) {
+			if (start < a[z.x].txEnd_) {
+				hits.push_back(&a[z.x]);
+			}
+			stack[top++] = { z.x + (static_cast<size_t>(1) << (z.k - 1)), z.k - 1, false };
+		}
+	}
+
+	const Transcript* base = a.data();
+	std::sort(hits.begin(), hits.end(), [&chrom, base](const Transcript* p, const Transcript* q) {
+			return chrom.order_[p - base] < chrom.order_[q - base];
+		});
+	return hits.size();
+}
+
+bool PositionOrder::Next(size_t chromId, int pos)
+{
+	if (static_cast<int>(chromId) != chromId_) {
+		if (chromId >= passed_.size() || passed_[chromId]) {
+			return false;
+		}
+		if (chromId_ >= 0) {
+			passed_[chromId_] = true;
+		}
+		chromId_ = chromId;
+	} else if (pos < lastPos_) {
+		return false;
+	}
+	lastPos_ = pos;
+	return true;
+}
+
+TranscriptSweep::TranscriptSweep(const TranscriptIndex& index):
+	index_(index), order_(index.chroms_.size()), next_(0)
+{
+}
+
+bool TranscriptSweep::Find(size_t chromId, int pos, std::vector<const Transcript*>& hits)
+{
+	hits.clear();
+	if (chromId >= index_.chroms_.size()) {
+		return true;
+	}
+	const TranscriptIndex::Chrom& chrom = index_.chroms_[chromId];
+	const std::vector<Transcript>& a = chrom.trans_;
+	const Transcript* base = a.data();
+
+	bool entered = (order_.GetChromId() != static_cast<int>(chromId));
+	if (!order_.Next(chromId, pos)) {
+		return false;
+	}
+	if (entered) { // seed the active set, then sweep from pos on
+		index_.Find(chromId, pos, pos + 1, hits);
+		active_.clear();
+		for (size_t i = 0; i < hits.size(); ++i) {
+			active_.push_back(hits[i] - base);
+		}
+		next_ = std::upper_bound(a.begin(), a.end(), pos, [](int p, const Transcript& t) {
+				return p < t.txStart_;
+			}) - a.begin();
+		return true;
+	}
+
+	size_t count = 0;
+	for (size_t i = 0; i < active_.size(); ++i) {
+		if (a[active_[i]].txEnd_ > pos) {
+			active_[count++] = active_[i];
+		}
+	}
+	active_.resize(count);
+	for (; next_ < a.size() && a[next_].txStart_ <= pos; ++next_) {
+		if (a[next_].txEnd_ > pos) {
+			active_.push_back(next_);
+		}
+	}
+
+	for (size_t i = 0; i < active_.size(); ++i) {
+		hits.push_back(&a[active_[i]]);
+	}
+	std::sort(hits.begin(), hits.end(), [&chrom, base](const Transcript* p, const Transcript* q) {
+			return chrom.order_[p - base] < chrom.order_[q - base];
+		});
+	return true;
+}
@@ -0,0 +1,91 @@
+#ifndef __TRANSCRIPT_INDEX_H__
+#define __TRANSCRIPT_INDEX_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Transcript.h"
+
+// Overlap index over the transcripts of each chromosome. Transcripts are
+// sorted by txStart and laid out as an implicit binary tree augmented with
+// the max txEnd of each subtree (as in cgranges), so a query takes
+// O(log n + k) and nothing is copied.
+//
+// Load() reads a refGene table downloaded from UCSC, or a database written by
+// Save() (see 'refgene-compile'). The database holds the transcripts of each
+// chromosome already sorted, as flat records, exon arrays and a string pool,
+// so loading it only copies them out of the mapped file, checks them and
+// builds the tree. Both inputs are checked alike, and bad refGene records are
+// skipped.
+class TranscriptIndex
+{
+public:
+	bool Load(const std::string& filename);
+	bool Save(const std::string& filename) const;
+
+	void Build(std::map<std::string, std::vector<Transcript>>& data);
+
+	bool Has(const std::string& chrom) const;
+	int GetId(const std::string& chrom) const;
+	size_t GetCount() const { return chroms_.size(); }
+	const std::string& GetName(size_t id) const { return chroms_[id].name_; }
+
+	// transcripts overlapping [start, end), reported in the order they were loaded
+	size_t Find(size_t chromId, int start, int end, std::vector<const Transcript*>& hits) const;
+private:
+	friend class TranscriptSweep;
+
+	struct Chrom
+	{
+		std::string name_;
+		std::vector<Transcript> trans_; // sorted by txStart_
+		std::vector<size_t> order_;     // loading order of each transcript
+		std::vector<int> maxEnd_;
+		int maxLevel_;
+	};
+
+	static int BuildTree(Chrom& chrom);
+	bool LoadDatabase(const char* data, size_t size);
+private:
+	std::vector<Chrom> chroms_;
+	std::map<std::string, size_t> index_;
+};
+
+// Order check of coordinate-sorted queries: positions do not go backwards
+// on a chromosome, and a chromosome is not revisited once left.
+class PositionOrder
+{
+public:
+	explicit PositionOrder(size_t chromCount): chromId_(-1), lastPos_(0), passed_(chromCount, false) { }
+
+	// false if pos comes out of order
+	bool Next(size_t chromId, int pos);
+	// chromosome of the last position, -1 before the first one
+	int GetChromId() const { return chromId_; }
+private:
+	int chromId_;
+	int lastPos_;
+	std::vector<bool> passed_;
+};
+
+// Sweep line over the index for coordinate-sorted queries. It keeps the
+// transcripts overlapping the current position active, admitting them by
+// txStart and evicting them by txEnd, so each query costs amortized
+// O(active transcripts). On entering a chromosome the active set is seeded by
+// TranscriptIndex::Find(), so a sweep may start anywhere in the input.
+class TranscriptSweep
+{
+public:
+	explicit TranscriptSweep(const TranscriptIndex& index);
+
+	// same as TranscriptIndex::Find() at a single position, returns false
+	// (and finds nothing) if queries are not sorted
+	bool Find(size_t chromId, int pos, std::vector<const Transcript*>& hits);
+private:
+	const TranscriptIndex& index_;
+	PositionOrder order_;
+	size_t next_;
+	std::vector<size_t> active_;
+};
+
+#endif
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include "BaseCount.h"
+
+// Throughput of the base counting kernels on a random sequence with mixed
+// case, N runs and a few IUPAC codes.
+//
+// Usage: basecount-bench [size_in_MB] [rounds]
+
+static std::string MakeSequence(size_t size)
+{
+	const char* bases = "ACGTacgt";
+	std::string seq(size, 'N');
+	unsigned int seed = 12345;
+	for (size_t i = 0; i < size; ++i) {
+		seed = seed * 1103515245 + 12345;
+		unsigned int r = (seed >> 16) & 0x7fff;
+		if (r % 1000 == 0) {
+			seq[i] = 'R';
+		} else if (r % 100 != 0) {
+			seq[i] = bases[r % 8];
+		}
+	}
+	return seq;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t size = (argc > 1 ? atol(argv[1]) : 256) << 20;
+	int rounds = (argc > 2 ? atoi(argv[2]) : 10);
+	std::string seq = MakeSequence(size);
+
+	std::cout << "dispatch: " << GetBaseCountKernelName() << std::endl;
+
+	BaseCounts expected;
+	GetBaseCountKernel("scalar")(seq.data(), seq.size(), expected);
+
+	const char* names[] = { "scalar", "sse2", "avx2" };
+	for (size_t k = 0; k < 3; ++k) {
+		BaseCountKernel kernel = GetBaseCountKernel(names[k]);
+		if (!kernel) {
+			std::cout << names[k] << ": not supported" << std::endl;
+			continue;
+		}
+		double best = 0;
+		for (int i = 0; i < rounds; ++i) {
+			BaseCounts counts;
+			auto start = std::chrono::steady_clock::now();
+			kernel(seq.data(), seq.size(), counts);
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			if (counts.a_ != expected.a_ || counts.c_ != expected.c_ || counts.g_ != expected.g_
+					|| counts.t_ != expected.t_ || counts.n_ != expected.n_) {
+				std::cerr << "Error: Kernel '" << names[k] << "' disagrees with the scalar one!" << std::endl;
+				return 1;
+			}
+			double rate = size / elapsed.count() / 1e9;
+			if (rate > best) {
+				best = rate;
+			}
+		}
+		printf("%s: %.2f GB/s\n", names[k], best);
+	}
+	return 0;
+}
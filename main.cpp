@@ -4,6 +4,9 @@
 #include "Annotate.h"
 #include "RegionGet.h"
 #include "RegionCount.h"
+#include "FastaPack.h"
+#include "RefGeneCompile.h"
+#include "Serve.h"
 #include "version.h"
 
 static void PrintUsage(const char* progname)
@@ -19,6 +22,9 @@ static void PrintUsage(const char* progname)
 		"    region-get     extract sequences in regions\n"
 		"    region-count   count bases in regions\n"
 		"    annotate       annotate genetic mutations\n"
+		"    fasta-pack     pack reference genome into a shareable image\n"
+		"    refgene-compile compile refGene table into a transcript database\n"
+		"    serve          annotate variants sent to a Unix domain socket\n"
 		<< std::endl;
 }
 
@@ -38,6 +44,12 @@ int main(int argc, char* const argv[])
 		return RegionCount_main(argc - 1, argv + 1);
 	} else if (cmd == "annotate") {
 		return Annotate_main(argc - 1, argv + 1);
+	} else if (cmd == "fasta-pack") {
+		return FastaPack_main(argc - 1, argv + 1);
+	} else if (cmd == "refgene-compile") {
+		return RefGeneCompile_main(argc - 1, argv + 1);
+	} else if (cmd == "serve") {
+		return Serve_main(argc - 1, argv + 1);
 	} else {
 		std::cerr << "Error: Unknown command '" << argv[1] << "'!\n" << std::endl;
 		PrintUsage(argv[0]);